@@ -1,444 +1,3603 @@
+#include <linux/bio.h>
+#include <linux/cgroup.h>
+#include <linux/cpufreq.h>
 #include <linux/debugfs.h>
 #include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/hash.h>
 #include <linux/init.h>
+#include <linux/kdev_t.h>
 #include <linux/kernel.h>
+#include <linux/kernel_stat.h>
 #include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/rbtree.h>
 #include <linux/sched.h>
 #include <linux/sched/signal.h>
 #include <linux/sched/tense.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/task_work.h>
+#include <linux/tracepoint.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+#include "tense.h"
+#include "tense_nop.h"
+#include "tense_trace.h"
 
 // Name for file in debugfs with the tense interface
 #define TENSE_NAME "tense"
 static struct dentry *debugfs_file;
 
+// Name for file in debugfs with statistics about the hooks
+#define TENSE_STATS_NAME "tense_stats"
+static struct dentry *debugfs_stats_file;
+
+// Name for file in debugfs with the binary event stream
+#define TENSE_EVENTS_NAME "tense_events"
+static struct dentry *debugfs_events_file;
+
+// Name for file in debugfs with the cgroups whose tasks are attached
+#define TENSE_CGROUPS_NAME "tense_cgroups"
+static struct dentry *debugfs_cgroups_file;
+
+// Name for file in debugfs taking a schedule to replay
+#define TENSE_REPLAY_NAME "tense_replay"
+static struct dentry *debugfs_replay_file;
+
 /* SECTION Parameters that can be set with command-line args to insmod */
 
 static u8 sync_type = 0;
 module_param(sync_type, byte, 0);
-MODULE_PARM_DESC(sync_type, "what synchronisation algorithm to use");
+MODULE_PARM_DESC(sync_type, "how tasks of experiments started from now on \
+	are kept together in virtual time: 0 not at all, 1 barrier, all tasks \
+	run up to the end of the current window of sync_bound before any \
+	starts the next, 2 lag, no task runs more than sync_bound ahead of the \
+	slowest, 3 lookahead, no task runs more than sync_bound past the \
+	earliest time at which another task runs or wakes up");
 
 static unsigned long sync_bound = 1000000;
 module_param(sync_bound, ulong, 0);
 MODULE_PARM_DESC(sync_bound, "don't allow processes which are ahead by more \
 	than sync_bound from the current min_time process to run any further; \
-	value is in nanoseconds and only applies if sync is enabled");
+	value is in nanoseconds and only applies if sync is enabled; it is the \
+	window for the barrier and the lookahead for lookahead sync");
+
+static unsigned long nops_per_ms = 0;
+module_param(nops_per_ms, ulong, 0444);
+MODULE_PARM_DESC(nops_per_ms, "how many iterations of the nop loop take \
+	approx. 1 ms; this value is acquired through calibration at load time \
+	and whenever the frequency of a CPU changes, unless it is set here");
+
+static u8 dilation = TENSE_DILATION_VRUNTIME;
+module_param(dilation, byte, 0);
+MODULE_PARM_DESC(dilation, "how time dilation affects CFS for experiments \
+	started from now on: 0 scales vruntime, so a faster task gets more CPU \
+	time; 1 scales the timeslice, so a faster task gets the same CPU time in \
+	longer slices and as many context switches as if it were really faster");
+
+static unsigned long min_slice = 750000;
+module_param(min_slice, ulong, 0);
+MODULE_PARM_DESC(min_slice, "shortest scaled timeslice in ns, the default \
+	minimum granularity of CFS; shorter slices are clamped");
+
+static unsigned long max_slice = 100000000;
+module_param(max_slice, ulong, 0);
+MODULE_PARM_DESC(max_slice, "longest scaled timeslice in ns; with extreme \
+	speedups a slice would otherwise delay other tasks for seconds");
+
+static unsigned long adapt_ms = 0;
+module_param(adapt_ms, ulong, 0);
+MODULE_PARM_DESC(adapt_ms, "period in ms of the controller which slows down \
+	experiments started from now on as a whole while their timelines drift \
+	apart or the CPUs are overloaded, and speeds them up again otherwise; \
+	0 turns it off");
+
+static unsigned long adapt_lag = 1000000;
+module_param(adapt_lag, ulong, 0);
+MODULE_PARM_DESC(adapt_lag, "lead in ns of the furthest timeline over \
+	min_time above which the controller slows an experiment down");
+
+static uint adapt_max = 10;
+module_param(adapt_max, uint, 0);
+MODULE_PARM_DESC(adapt_max, "largest slowdown the controller applies");
+
+static bool futex_sync = true;
+module_param(futex_sync, bool, 0);
+MODULE_PARM_DESC(futex_sync, "a tense task woken through a futex by another \
+	tense task of its experiment, e.g. when a mutex is released, resumes no \
+	earlier than the virtual time of the waker");
+
+static bool record = false;
+module_param(record, bool, 0644);
+MODULE_PARM_DESC(record, "only record the events needed to replay a run in \
+	tense_events: joins, switches, sleeps, wakeups and TDF changes");
+
+static unsigned long replay_timeout_ms = 100;
+module_param(replay_timeout_ms, ulong, 0);
+MODULE_PARM_DESC(replay_timeout_ms, "how long a task of a replayed schedule \
+	waits for the tasks before its turn before it skips them");
+
+static bool deterministic = false;
+module_param(deterministic, bool, 0);
+MODULE_PARM_DESC(deterministic, "run the tasks of experiments started from \
+	now on one at a time in order of virtual time, ties going to the task \
+	which joined first, instead of as CFS picks them");
+
+static unsigned long fast_forward_us = 0;
+module_param(fast_forward_us, ulong, 0644);
+MODULE_PARM_DESC(fast_forward_us, "once no task of an experiment started from \
+	now on is runnable for this long, jump its virtual time straight to the \
+	next wakeup, 0 to wait for wakeups in real time");
+
+static bool balance = false;
+module_param(balance, bool, 0644);
+MODULE_PARM_DESC(balance, "the load balancer only moves a task of an \
+	experiment started from now on to a CPU whose timeline is within \
+	balance_bound of the task, or to a CPU without tasks of the experiment");
+
+static unsigned long balance_bound = 1000000;
+module_param(balance_bound, ulong, 0644);
+MODULE_PARM_DESC(balance_bound, "largest jump in virtual time in ns which a \
+	migration may cause a task when balance is on");
+
+static u8 fault_model = 0;
+module_param(fault_model, byte, 0644);
+MODULE_PARM_DESC(fault_model, "page faults of tasks of experiments started \
+	from now on whose real cost is replaced by a virtual one: 0 none, \
+	1 minor, 2 major, 3 both");
+
+static unsigned long minor_fault_ns = 1000;
+module_param(minor_fault_ns, ulong, 0644);
+MODULE_PARM_DESC(minor_fault_ns, "virtual cost in ns of a minor fault, \
+	charged as if the task ran for that long");
+
+static unsigned long minor_fault_spread_ns = 0;
+module_param(minor_fault_spread_ns, ulong, 0644);
+MODULE_PARM_DESC(minor_fault_spread_ns, "the cost of a minor fault is drawn \
+	uniformly from minor_fault_ns plus or minus this many ns");
+
+static unsigned long major_fault_ns = 100000;
+module_param(major_fault_ns, ulong, 0644);
+MODULE_PARM_DESC(major_fault_ns, "virtual cost in ns of a major fault, \
+	which the task waits for like for I/O");
+
+static unsigned long major_fault_spread_ns = 0;
+module_param(major_fault_spread_ns, ulong, 0644);
+MODULE_PARM_DESC(major_fault_spread_ns, "the cost of a major fault is drawn \
+	uniformly from major_fault_ns plus or minus this many ns");
+
+static unsigned long event_buffer_kb = 256;
+module_param(event_buffer_kb, ulong, 0);
+MODULE_PARM_DESC(event_buffer_kb, "size of the per-cpu buffer behind the \
+	tense_events file in KiB");
+
+/* SECTION Tense core */
+
+/*
+ * This struct holds function pointers to hooks that exist in the
+ * scheduler of a modified Linux kernel that supports tense. It's used for
+ * ease of development - recompile the module only if no actual changes to
+ * the logic of the hooks are needed.
+ */
+extern struct tense_operations *tense;
+
+static void init (void);
+
+static struct tense_task *add_task(struct tense_experiment *exp,
+	struct task_struct *p, struct tense_cgroup *cg, gfp_t gfp);
+
+static void remove_task(struct tense_task *task);
+
+static void put_cgroup(struct tense_cgroup *cg);
+
+static u64 update_curr (u64 delta_exec);
+
+static void after_task_tick(struct task_struct *curr);
+
+static void switch_in(struct task_struct *next);
+
+static void io_finish(void);
+
+static void futex_wake(struct task_struct *p);
+
+static u64 sched_slice(struct task_struct *p, u64 slice);
+
+static bool can_migrate(struct task_struct *p, int dst_cpu);
+
+static void fault_start(void);
+
+static void fault_finish(int ret);
+
+static void wake_up_sleepers(struct tense_experiment *exp);
+
+static void program_sleepers(struct tense_experiment *exp, int cpu,
+	struct tense_task *running);
+
+static enum hrtimer_restart sleepers_timer(struct hrtimer *timer);
+
+static void adapt_experiment(struct work_struct *work);
+
+static void throttle_current(struct tense_task *task);
+
+static void sync_throttle(struct callback_head *work);
+
+static void replay_switch(struct tense_task *task);
+
+static void replay_wait(struct callback_head *work);
+
+static void free_replay(struct tense_replay *rp);
+
+static bool det_first(struct tense_experiment *exp, struct tense_task *task);
+
+static void det_yield(struct tense_task *task);
+
+static void det_wait(struct callback_head *work);
+
+static enum hrtimer_restart fast_forward(struct hrtimer *timer);
+
+static void set_current_tdf (u32 faster, u32 slower);
+
+static u64 tense_current_time (void);
+
+static u64 scale_exec(struct tense_task *task, u64 delta_exec);
+
+static void reset_split(struct tense_task *task, struct task_struct *p);
+
+static void sync_split(struct tense_task *task, struct task_struct *p);
+
+/* SECTION Macros to trace events in hooks */
+
+/*
+ * Hooks report events through tense_trace which fires the tense_* tracepoint
+ * and records the event for the tense_events file. Both are patched out
+ * branches while nobody listens, so the module doesn't use printk at all. In
+ * record mode only the events in TENSE_RECORD_EVENTS go to the file.
+ */
+#define tense_trace(name, type, task, time, arg) do {			\
+	trace_tense_##name(task, time, arg);				\
+	if (!record || (BIT(TENSE_EVENT_##type) & TENSE_RECORD_EVENTS))	\
+		tense_event(TENSE_EVENT_##type, task, time, arg);	\
+} while (0)
+
+/* SECTION Tense multicore implementation */
+
+#define TENSE_STALE (2 * TICK_NSEC)
+
+/*
+ * All experiments. The lock only protects the list, lookups from tasks go
+ * through task->experiment.
+ */
+static LIST_HEAD(experiments);
+static DEFINE_SPINLOCK(experiments_lock);
+static atomic_t next_experiment_id;
+
+// Written through the replay file, taken by the next experiment created
+static struct tense_replay *replay_next;
+
+/*
+ * Experiments holding tense_active, which patches the hooks into the scheduler.
+ * It is taken when an experiment is created, before it can have tasks, and
+ * released from a work item since the last reference to an experiment can go
+ * in atomic context while switching the key sleeps.
+ */
+static atomic_t hooks_puts;
+
+static void put_hooks_work(struct work_struct *work)
+{
+	while (atomic_add_unless(&hooks_puts, -1, 0))
+		static_branch_dec(&tense_active);
+}
+
+static DECLARE_WORK(hooks_work, put_hooks_work);
+
+static void put_hooks(void)
+{
+	atomic_inc(&hooks_puts);
+	schedule_work(&hooks_work);
+}
+
+/*
+ * struct tense_stats - cost of the hooks on one CPU
+ *
+ * @ticks:	number of after_task_tick calls for tense tasks
+ * @tick_ns:	total time spent in those calls
+ * @tick_max_ns:	longest of those calls
+ * @wakeups:	sleepers woken up from the tick or a timer
+ * @futex_wakes:	futex wakeups which passed virtual time to the woken task
+ * @slices_clamped:	scaled timeslices that were clamped to min or max_slice
+ * @throttles:	tasks made to wait for the others by sync_type
+ * @kernel_ns:	runtime charged at the kernel factor of its task
+ * @irq_ns:	runtime charged at the interrupt factor of its task
+ * @overhead_ns:	runtime spent in tense itself and left out of virtual time
+ * @wakeup_error:	sleepers by how late in virtual time they were woken up,
+ *		0 ns in the first bucket and [4^(i - 1), 4^i) ns in the ith
+ */
+#define TENSE_WAKEUP_ERRORS 16
+
+struct tense_stats {
+	u64	ticks;
+	u64	tick_ns;
+	u64	tick_max_ns;
+	u64	wakeups;
+	u64	futex_wakes;
+	u64	slices_clamped;
+	u64	throttles;
+	u64	kernel_ns;
+	u64	irq_ns;
+	u64	overhead_ns;
+	u64	wakeup_error[TENSE_WAKEUP_ERRORS];
+};
+
+static DEFINE_PER_CPU(struct tense_stats, stats);
+
+
+static void init (void)
+{
+	tense->update_curr = &update_curr;
+	tense->after_task_tick = &after_task_tick;
+	tense->switch_in = &switch_in;
+	tense->io_finish = &io_finish;
+	tense->futex_wake = &futex_wake;
+	tense->sched_slice = &sched_slice;
+	tense->can_migrate = &can_migrate;
+	tense->fault_start = &fault_start;
+	tense->fault_finish = &fault_finish;
+}
+
+/*
+ * Create an experiment with its own timelines starting at 0 and default
+ * parameters taken from the module parameters.
+ */
+static struct tense_experiment *create_experiment(void)
+{
+	struct tense_experiment *exp;
+	int i, cpu;
+
+	exp = kzalloc(sizeof(*exp), GFP_KERNEL);
+	if (!exp)
+		return NULL;
+
+	exp->timelines = alloc_percpu(struct tense_timeline);
+	exp->sleepers = alloc_percpu(struct tense_sleepers);
+	exp->vvar = tense_vvar_alloc();
+	if (!exp->timelines || !exp->sleepers || !exp->vvar)
+		goto bad_alloc;
+
+	if (!zalloc_cpumask_var(&exp->tense_mask, GFP_KERNEL))
+		goto bad_alloc;
+
+	if (!zalloc_cpumask_var(&exp->sleepers_mask, GFP_KERNEL))
+		goto bad_sleepers_mask;
+
+	for_each_possible_cpu(cpu) {
+		struct tense_sleepers *sl = per_cpu_ptr(exp->sleepers, cpu);
+
+		raw_spin_lock_init(&sl->lock);
+		sl->root = RB_ROOT_CACHED;
+		hrtimer_init(&sl->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+		sl->timer.function = sleepers_timer;
+		sl->experiment = exp;
+		sl->cpu = cpu;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(exp->tasks); i++) {
+		spin_lock_init(&exp->tasks[i].lock);
+		INIT_LIST_HEAD(&exp->tasks[i].list);
+	}
+
+	spin_lock_init(&exp->io_lock);
+	init_waitqueue_head(&exp->sync_wait);
+
+	exp->replay = xchg(&replay_next, NULL);
+
+	kref_init(&exp->ref);
+	exp->id = atomic_inc_return(&next_experiment_id);
+	exp->sync_type = sync_type;
+	exp->sync_bound = sync_bound;
+	exp->dilation = dilation;
+
+	exp->deterministic = deterministic;
+	if (deterministic && !IS_ENABLED(CONFIG_IRQ_TIME_ACCOUNTING))
+		pr_warn_once("tense: deterministic mode without "
+			"CONFIG_IRQ_TIME_ACCOUNTING counts interrupts as virtual "
+			"time\n");
+
+	exp->fast_forward = ns_to_ktime(fast_forward_us * NSEC_PER_USEC);
+	hrtimer_init(&exp->forward_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	exp->forward_timer.function = fast_forward;
+	seqcount_init(&exp->forward_seq);
+
+	exp->balance = balance;
+	exp->balance_bound = balance_bound;
+
+	exp->fault_model = fault_model;
+	exp->fault_cost[TENSE_FAULT_MINOR].ns = minor_fault_ns;
+	exp->fault_cost[TENSE_FAULT_MINOR].spread = minor_fault_spread_ns;
+	exp->fault_cost[TENSE_FAULT_MAJOR].ns = major_fault_ns;
+	exp->fault_cost[TENSE_FAULT_MAJOR].spread = major_fault_spread_ns;
+
+	exp->adapt = 1000;
+	exp->speed = 1000;
+	exp->adapt_ms = adapt_ms;
+	exp->adapt_lag = adapt_lag;
+	INIT_DELAYED_WORK(&exp->adapt_work, adapt_experiment);
+	if (exp->adapt_ms) {
+		kref_get(&exp->ref);
+		schedule_delayed_work(&exp->adapt_work,
+			msecs_to_jiffies(exp->adapt_ms));
+	}
+
+	static_branch_inc(&tense_active);
+
+	spin_lock(&experiments_lock);
+	list_add(&exp->list, &experiments);
+	spin_unlock(&experiments_lock);
+
+	return exp;
+
+bad_sleepers_mask:
+	free_cpumask_var(exp->tense_mask);
+
+bad_alloc:
+	if (exp->vvar)
+		tense_vvar_free(exp->vvar);
+	free_percpu(exp->sleepers);
+	free_percpu(exp->timelines);
+	kfree(exp);
+	return NULL;
+}
+
+static void free_experiment_rcu(struct rcu_head *rcu)
+{
+	struct tense_experiment *exp =
+		container_of(rcu, struct tense_experiment, rcu);
+
+	free_cpumask_var(exp->sleepers_mask);
+	free_cpumask_var(exp->tense_mask);
+	tense_vvar_free(exp->vvar);
+	free_replay(exp->replay);
+	free_percpu(exp->sleepers);
+	free_percpu(exp->timelines);
+	kfree(exp);
+}
+
+static void release_experiment(struct kref *ref)
+{
+	struct tense_experiment *exp =
+		container_of(ref, struct tense_experiment, ref);
+	int cpu;
+
+	spin_lock(&experiments_lock);
+	list_del(&exp->list);
+	spin_unlock(&experiments_lock);
+
+	// Fast-forward programs the sleepers, so it goes first
+	hrtimer_cancel(&exp->forward_timer);
+	for_each_possible_cpu(cpu)
+		hrtimer_cancel(&per_cpu_ptr(exp->sleepers, cpu)->timer);
+
+	call_rcu(&exp->rcu, free_experiment_rcu);
+	put_hooks();
+}
+
+static inline void put_experiment(struct tense_experiment *exp)
+{
+	kref_put(&exp->ref, release_experiment);
+}
+
+/*
+ * Experiment of any tense thread of @p. Tense tasks are freed after a grace
+ * period and experiments only once they have no references, so this is safe
+ * under rcu_read_lock.
+ */
+static struct tense_experiment *
+thread_group_experiment(struct task_struct *p)
+{
+	struct tense_experiment *exp;
+	struct tense_task *task;
+	struct task_struct *t;
+
+	for_each_thread(p, t) {
+		task = READ_ONCE(t->tense_task);
+		if (!task)
+			continue;
+
+		exp = task->experiment;
+		if (kref_get_unless_zero(&exp->ref))
+			return exp;
+	}
+
+	return NULL;
+}
+
+/*
+ * A task joins the experiment of its own process, otherwise that of its
+ * parent process so that programs started from a tense process are part of the
+ * same experiment. Anything else starts a new experiment.
+ */
+static struct tense_experiment *find_experiment(void)
+{
+	struct tense_experiment *exp;
+
+	rcu_read_lock();
+	exp = thread_group_experiment(current);
+	if (!exp)
+		exp = thread_group_experiment(rcu_dereference(current->real_parent));
+	rcu_read_unlock();
+
+	return exp;
+}
+
+static inline struct tense_tasks_bucket *
+tense_tasks_bucket(struct tense_task *task)
+{
+	return &task->experiment->tasks[hash_ptr(task, TENSE_TASKS_BITS)];
+}
+
+/*
+ * Queue @task on the sleepers of @cpu. Its wakeup_time must not change while
+ * it is queued.
+ */
+static void enqueue_sleeper(struct tense_task *task, int cpu)
+{
+	struct tense_experiment *exp = task->experiment;
+	struct tense_sleepers *sl = per_cpu_ptr(exp->sleepers, cpu);
+	struct rb_node **link = &sl->root.rb_root.rb_node, *parent = NULL;
+	struct tense_task *entry;
+	bool leftmost = true;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&sl->lock, flags);
+
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct tense_task, sleeper);
+
+		if (task->wakeup_time < entry->wakeup_time) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+
+	task->sleep_cpu = cpu;
+	rb_link_node(&task->sleeper, parent, link);
+	rb_insert_color_cached(&task->sleeper, &sl->root, leftmost);
+	cpumask_set_cpu(cpu, exp->sleepers_mask);
+
+	raw_spin_unlock_irqrestore(&sl->lock, flags);
+}
+
+/*
+ * Must be called with the lock of sleepers on task->sleep_cpu held. Marks
+ * @task awake first, it may find itself dequeued without the lock and go to
+ * sleep again right away.
+ */
+static inline void __dequeue_sleeper(struct tense_sleepers *sl,
+	struct tense_task *task)
+{
+	WRITE_ONCE(task->wakeup_time, U64_MAX);
+	smp_wmb();
+
+	rb_erase_cached(&task->sleeper, &sl->root);
+	RB_CLEAR_NODE(&task->sleeper);
+
+	if (RB_EMPTY_ROOT(&sl->root.rb_root))
+		cpumask_clear_cpu(task->sleep_cpu, task->experiment->sleepers_mask);
+}
+
+// Take @task off the sleepers if it is queued and mark it awake
+static void dequeue_sleeper(struct tense_task *task)
+{
+	struct tense_sleepers *sl;
+	unsigned long flags;
+
+	if (RB_EMPTY_NODE(&task->sleeper)) {
+		WRITE_ONCE(task->wakeup_time, U64_MAX);
+		return;
+	}
+
+	sl = per_cpu_ptr(task->experiment->sleepers, task->sleep_cpu);
+
+	raw_spin_lock_irqsave(&sl->lock, flags);
+	if (!RB_EMPTY_NODE(&task->sleeper))
+		__dequeue_sleeper(sl, task);
+	raw_spin_unlock_irqrestore(&sl->lock, flags);
+}
+
+static inline void
+set_cpu_tense(struct tense_experiment *exp, unsigned int cpu, bool is_tense)
+{
+	if (is_tense)
+		cpumask_set_cpu(cpu, exp->tense_mask);
+	else
+		cpumask_clear_cpu(cpu, exp->tense_mask);
+}
+
+/*
+ * Bring the timeline of this CPU up to date for @task which is about to run or
+ * is running on it. A CPU which was not running tasks of the experiment joins
+ * at its minimum, even where its stale timeline was left ahead. The timeline
+ * never falls behind the position of the task so that virtual time does not go
+ * back for it after a migration.
+ */
+static inline struct tense_timeline *
+this_timeline(struct tense_task *task)
+{
+	struct tense_experiment *exp = task->experiment;
+	struct tense_timeline *tl = this_cpu_ptr(exp->timelines);
+	int cpu = smp_processor_id();
+	unsigned int seq;
+	u64 min_time;
+	bool active;
+
+	// Wait out a fast-forward which may drop this CPU, see fast_forward
+	do {
+		seq = read_seqcount_begin(&exp->forward_seq);
+		active = cpu_tense(exp, cpu);
+		min_time = READ_ONCE(exp->min_time);
+	} while (read_seqcount_retry(&exp->forward_seq, seq));
+
+	tl->time = tense_timeline_join(tl->time, active, min_time, task->vtime);
+
+	if (unlikely(!active))
+		set_cpu_tense(exp, cpu, true);
+
+	tl->updated = local_clock();
+
+	return tl;
+}
+
+/*
+ * Move the minimum of @exp forward to @min. CPUs update it concurrently from
+ * their ticks and from sync_throttle, so a plain store could let a smaller
+ * minimum land last and take it back. Returns whether it moved, with the value
+ * it replaced or, if it didn't, the current one in @old.
+ */
+static bool advance_min_time(struct tense_experiment *exp, u64 min, u64 *old)
+{
+	u64 cur = READ_ONCE(exp->min_time), next, prev;
+
+	for (;;) {
+		next = tense_min_advance(cur, min);
+		if (next == cur)
+			break;
+
+		prev = cmpxchg64(&exp->min_time, cur, next);
+		if (prev == cur) {
+			*old = cur;
+			return true;
+		}
+		cur = prev;
+	}
+
+	*old = cur;
+	return false;
+}
+
+/*
+ * Recompute the minimum of the experiment. CPUs which have not updated their
+ * timeline for a while no longer run tense tasks and are dropped from the mask.
+ */
+static void update_min_time(struct tense_experiment *exp)
+{
+	struct tense_timeline *tl;
+	u64 min = U64_MAX, now = local_clock(), old;
+	int cpu;
+
+	for_each_cpu(cpu, exp->tense_mask) {
+		tl = per_cpu_ptr(exp->timelines, cpu);
+
+		if (now > READ_ONCE(tl->updated) + TENSE_STALE) {
+			set_cpu_tense(exp, cpu, false);
+			continue;
+		}
+
+		min = min(min, READ_ONCE(tl->time));
+	}
+
+	if (advance_min_time(exp, min, &old) && wq_has_sleeper(&exp->sync_wait))
+		wake_up_all(&exp->sync_wait);
+}
+
+/*
+ * Virtual time which decides when a task sleeping on @cpu wakes up. A CPU
+ * without tense tasks has a stale timeline so its sleepers follow the minimum
+ * of the experiment instead.
+ */
+static inline u64 cpu_time(struct tense_experiment *exp, int cpu)
+{
+	return tense_cpu_time(cpu_tense(exp, cpu),
+		READ_ONCE(per_cpu_ptr(exp->timelines, cpu)->time),
+		READ_ONCE(exp->min_time));
+}
+
+/*
+ * Real to virtual time and back for @task, see tense_scale.h. Both only
+ * multiply and shift.
+ */
+#define scale(x, task) \
+	tense_scale_apply((x), (task)->scale_mult, (task)->scale_shift)
+#define scale_inv(x, task) \
+	tense_scale_apply((x), (task)->inv_mult, (task)->inv_shift)
+
+/*
+ * Set the time dilation factor of @task, reduced to lowest terms, along with
+ * the multipliers used to apply it. Hooks for @task only run on its own CPU,
+ * so it is enough to call this with interrupts disabled there.
+ */
+static void set_task_tdf(struct tense_task *task, u32 faster, u32 slower)
+{
+	u32 g = tense_gcd(faster, slower);
+
+	task->faster = faster / g;
+	task->slower = slower / g;
+
+	tense_scale_calc(&task->scale_mult, &task->scale_shift,
+		task->slower, task->faster);
+	tense_scale_calc(&task->inv_mult, &task->inv_shift,
+		task->faster, task->slower);
+}
+
+/*
+ * Set the factor of @task to its base factor composed with the top of its warp
+ * stack and the slowdown of its experiment. The stack is written by user space
+ * at any time, so only its seq tells whether it changed, and anything read
+ * from it may be garbage.
+ */
+static void set_task_warp(struct tense_task *task)
+{
+	struct tense_warp *warp = READ_ONCE(task->warp);
+	u32 depth, top_faster = 1, top_slower = 1, faster, slower;
+
+	if (warp) {
+		task->warp_seq = READ_ONCE(warp->seq);
+		smp_rmb();
+
+		depth = READ_ONCE(warp->depth);
+		if (depth && depth <= TENSE_WARP_DEPTH) {
+			top_faster = READ_ONCE(warp->stack[depth - 1].faster);
+			top_slower = READ_ONCE(warp->stack[depth - 1].slower);
+		}
+
+		if (!top_faster || !top_slower)
+			top_faster = top_slower = 1;
+	}
+
+	task->adapt = READ_ONCE(task->experiment->adapt);
+
+	tense_compose_tdf(&faster, &slower, task->base_faster,
+		task->base_slower, top_faster, top_slower, task->adapt);
+
+	set_task_tdf(task, faster, slower);
+}
+
+/*
+ * Apply a push or pop on the warp stack of current, a new factor of the
+ * cgroup it was attached through or a new slowdown of its experiment. Called
+ * from the hooks with interrupts disabled, so it can't race with the process
+ * which is current.
+ */
+static inline bool check_tdf(struct tense_task *task)
+{
+	struct tense_warp *warp = READ_ONCE(task->warp);
+	struct tense_cgroup *cg = task->cgroup;
+	bool changed = false;
+	u64 tdf;
+
+	if (unlikely(cg)) {
+		tdf = READ_ONCE(cg->tdf);
+		if (tdf != task->cgroup_tdf) {
+			task->cgroup_tdf = tdf;
+			task->base_faster = tdf >> 32;
+			task->base_slower = (u32) tdf;
+			changed = true;
+		}
+	}
+
+	if (unlikely(warp && READ_ONCE(warp->seq) != task->warp_seq))
+		changed = true;
+
+	if (unlikely(READ_ONCE(task->experiment->adapt) != task->adapt))
+		changed = true;
+
+	if (changed)
+		set_task_warp(task);
+
+	return changed;
+}
+
+/*
+ * The timer is armed for the rest of the wait at the factor of the task, but
+ * the timeline it sleeps on moves at the factor of whoever runs there. While
+ * tense tasks still run on that CPU and have not reached the wakeup time yet,
+ * wait for the rest of it again. Once its timeline goes stale, nobody else
+ * moves virtual time forward and the wait is over. The timer may fire before
+ * the task is queued on the sleepers of its CPU, so that CPU is taken from the
+ * task_struct.
+ */
+static enum hrtimer_restart tense_wakeup_timer(struct hrtimer *timer)
+{
+	struct tense_task *task =
+		container_of(timer, struct tense_task, wakeup_timer);
+	struct tense_experiment *exp = task->experiment;
+	u64 wakeup_time = READ_ONCE(task->wakeup_time);
+	int cpu = task_cpu(task->task_struct);
+	u64 updated = READ_ONCE(per_cpu_ptr(exp->timelines, cpu)->updated);
+	u64 now = cpu_time(exp, cpu);
+
+	if (wakeup_time != U64_MAX && now < wakeup_time && cpu_tense(exp, cpu)
+			&& local_clock() <= updated + TENSE_STALE) {
+		hrtimer_forward_now(timer,
+			ns_to_ktime(scale_inv(wakeup_time - now, task)));
+		return HRTIMER_RESTART;
+	}
+
+	tense_trace(wakeup, WAKEUP, task, now, wakeup_time);
+
+	/*
+	 * remove_task cancels the timer before it frees @task, so it stays
+	 * valid here even if a signal wakes the task up in the meantime.
+	 */
+	dequeue_sleeper(task);
+	wake_up_process(task->task_struct);
+	this_cpu_inc(stats.wakeups);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * RCU readers walking the tasks of an experiment, e.g. det_first, look at the
+ * task_struct too, so the reference to it goes with the tense task.
+ */
+static void free_task_rcu(struct rcu_head *rcu)
+{
+	struct tense_task *task = container_of(rcu, struct tense_task, rcu);
+
+	put_task_struct(task->task_struct);
+	kfree(task);
+}
+
+/*
+ * Make @p a tense task in @exp, taking over the reference to @exp on success.
+ * This is current, which opened the file, or a task of the cgroup @cg, which
+ * may be running elsewhere. @p starts using its tense task once it is
+ * published, and fails with NULL if it already has one.
+ */
+static struct tense_task *
+add_task(struct tense_experiment *exp, struct task_struct *p,
+	struct tense_cgroup *cg, gfp_t gfp)
+{
+	struct tense_task *task;
+	struct tense_tasks_bucket *bucket;
+
+	task = kmalloc(sizeof(*task), gfp);
+	if (!task)
+		return NULL;
+
+	get_task_struct(p);
+	task->task_struct = p;
+	task->experiment = exp;
+	task->index = atomic_inc_return(&exp->next_index) - 1;
+
+	task->vtime = READ_ONCE(exp->min_time);
+	task->wakeup_time = U64_MAX;
+	hrtimer_init(&task->wakeup_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	task->wakeup_timer.function = tense_wakeup_timer;
+
+	RB_CLEAR_NODE(&task->sleeper);
+	task->sleep_cpu = -1;
+
+	task->base_faster = 1;
+	task->base_slower = 1;
+	task->warp = NULL;
+	task->warp_seq = 0;
+
+	task->cgroup = cg;
+	task->cgroup_tdf = 0;
+	task->detach_on_exit = cg != NULL;
+	if (cg) {
+		kref_get(&cg->ref);
+		task->cgroup_tdf = READ_ONCE(cg->tdf);
+		task->base_faster = task->cgroup_tdf >> 32;
+		task->base_slower = (u32) task->cgroup_tdf;
+	}
+
+	set_task_warp(task);
+
+	task->kernel_tdf = 0;
+	task->kernel_mult = 0;
+	task->kernel_shift = 0;
+	task->irq_tdf = 0;
+	task->irq_mult = 0;
+	task->irq_shift = 0;
+	reset_split(task, p);
+	task->overhead = 0;
+
+	task->fault_depth = 0;
+	task->fault_start = 0;
+	task->fault_exec = 0;
+	task->fault_vtime = 0;
+	task->fault_io = 0;
+	task->fault_major = false;
+	task->fault_end = 0;
+	prandom_seed_state(&task->fault_rnd, task->index + 1);
+
+	task->next_io_duration = 0;
+	task->io_start = 0;
+	task->io_vtime = 0;
+	task->io_dev = 0;
+	task->wake_vtime = 0;
+	task->det_waiting = false;
+
+	bucket = tense_tasks_bucket(task);
+	spin_lock(&bucket->lock);
+	list_add_rcu(&task->list, &bucket->list);
+	spin_unlock(&bucket->lock);
+	atomic_inc(&exp->nr_tasks);
+
+	if (cmpxchg(&p->tense_task, NULL, task)) {
+		spin_lock(&bucket->lock);
+		list_del_rcu(&task->list);
+		spin_unlock(&bucket->lock);
+		atomic_dec(&exp->nr_tasks);
+		if (cg)
+			put_cgroup(cg);
+		call_rcu(&task->rcu, free_task_rcu);
+		return NULL;
+	}
+
+	tense_trace(join, JOIN, task, task->vtime, task->index);
+
+	return task;
+}
+
+/*
+ * Remove @task from its experiment. This is usually current, but it may also
+ * be a task which has exited without closing the file, or one attached through
+ * a cgroup when the module is unloaded.
+ */
+static void remove_task(struct tense_task *task)
+{
+	struct tense_experiment *exp = task->experiment;
+	struct tense_tasks_bucket *bucket;
+	task_work_func_t func;
+
+	tense_trace(leave, LEAVE, task, task->vtime, task->index);
+
+	WRITE_ONCE(task->task_struct->tense_task, NULL);
+
+	hrtimer_cancel(&task->wakeup_timer);
+	dequeue_sleeper(task);
+
+	// A tense_work which already runs sees that the task is gone
+	func = READ_ONCE(task->task_struct->tense_work.func);
+	if (func && tense_task_work_cancel(task->task_struct, func)) {
+		WRITE_ONCE(task->task_struct->tense_work.func, NULL);
+		module_put(THIS_MODULE);
+	}
+
+	bucket = tense_tasks_bucket(task);
+	spin_lock(&bucket->lock);
+	list_del_rcu(&task->list);
+	spin_unlock(&bucket->lock);
+	atomic_dec(&exp->nr_tasks);
+
+	tense_warp_free(task);
+	if (task->cgroup)
+		put_cgroup(task->cgroup);
+	call_rcu(&task->rcu, free_task_rcu);
+
+	put_experiment(exp);
+}
+
+/*
+ * Move current, which is @task, forward by @vdelta of virtual time for
+ * @delta_exec of real time and return what CFS adds to its vruntime.
+ */
+static u64 advance_curr(struct tense_task *task, u64 delta_exec, u64 vdelta)
+{
+	struct tense_timeline *tl;
+
+	tl = this_timeline(task);
+
+	tl->time += vdelta;
+	tl->exec += delta_exec;
+	tl->vexec += vdelta;
+	task->vtime = tl->time;
+
+	// The time up to here ran at the old factor
+	if (check_tdf(task)) {
+		tense_trace(tdf, TDF, task, tl->time,
+			(u64) task->faster << 32 | task->slower);
+		if (cpumask_test_cpu(smp_processor_id(),
+			task->experiment->sleepers_mask))
+			program_sleepers(task->experiment, smp_processor_id(),
+				task);
+	}
+
+	tense_vvar_publish(task->experiment->vvar, smp_processor_id(),
+		tl->time, task);
+
+	tense_trace(update, UPDATE, task, tl->time, vdelta);
+
+	/*
+	 * This is a call to update_curr from deactivate_task when the task is
+	 * about to sleep. Add the last delta_exec to get accurate wakeup_time.
+	 */
+	if (task->wakeup_time != U64_MAX && RB_EMPTY_NODE(&task->sleeper))
+		task->wakeup_time += vdelta;
+
+	// With timeslice dilation vruntime follows real time, see sched_slice
+	if (task->experiment->dilation == TENSE_DILATION_SLICE)
+		return delta_exec;
+
+	return vdelta;
+}
+
+static u64 update_curr(u64 delta_exec)
+{
+	struct tense_task *task = current->tense_task;
+
+	if (!task)
+		return delta_exec;
+
+	return advance_curr(task, delta_exec, scale_exec(task, delta_exec));
+}
+
+/*
+ * Called by CFS for the timeslice of @p, already weighted by its nice value.
+ * With timeslice dilation a task which is n times faster gets slices n times
+ * as long, within min_slice and max_slice. It then runs as much virtual time
+ * between context switches as real code n times faster would, while its share
+ * of the CPU stays the same since vruntime is not scaled.
+ */
+static u64 sched_slice(struct task_struct *p, u64 slice)
+{
+	struct tense_task *task;
+	u64 scaled = slice;
+
+	rcu_read_lock();
+	task = READ_ONCE(p->tense_task);
+	if (task && task->experiment->dilation == TENSE_DILATION_SLICE)
+		scaled = scale_inv(slice, task);
+	rcu_read_unlock();
+
+	if (scaled == slice)
+		return slice;
+
+	if (unlikely(scaled < min_slice || scaled > max_slice)) {
+		pr_warn_once("tense: clamping timeslice of %llu ns to [%lu, %lu]\n",
+			scaled, min_slice, max_slice);
+		this_cpu_inc(stats.slices_clamped);
+		scaled = clamp_t(u64, scaled, min_slice, max_slice);
+	}
+
+	return scaled;
+}
+
+/*
+ * This is a chance to do anything that needs to be atomic against schedule such
+ * as waking up tasks. Interrupts are disabled.
+ */
+static void after_task_tick(struct task_struct *curr)
+{
+	struct tense_task *task = curr->tense_task;
+	struct tense_stats *st;
+	u64 start, delta;
+
+	if (!task)
+		return;
+
+	start = local_clock();
+
+	update_min_time(task->experiment);
+	wake_up_sleepers(task->experiment);
+
+	if (task->experiment->sync_type != TENSE_SYNC_NONE)
+		throttle_current(task);
+
+	// Someone else may have fallen behind the task by now
+	if (task->experiment->deterministic
+		&& !det_first(task->experiment, task))
+		det_yield(task);
+
+	delta = local_clock() - start;
+
+	// Charged to current by its next update_curr, unless it is irq time
+	if (!IS_ENABLED(CONFIG_IRQ_TIME_ACCOUNTING))
+		task->overhead += delta;
+
+	st = this_cpu_ptr(&stats);
+	st->ticks++;
+	st->tick_ns += delta;
+	st->tick_max_ns = max(st->tick_max_ns, delta);
+}
+
+/*
+ * Called from __schedule with the rq lock held once the next task is picked.
+ * Publishes a fresh snapshot for user space so that it only extrapolates over
+ * time in which @next was actually running.
+ *
+ * Current is still the previous task at this point. If it is going to sleep in
+ * virtual time, the last update_curr from deactivate_task has already fixed its
+ * wakeup_time, so this is where it joins the sleepers.
+ */
+static void switch_in(struct task_struct *next)
+{
+	struct tense_task *prev = current->tense_task;
+	struct tense_task *task = next->tense_task;
+	struct tense_timeline *tl;
+
+	if (prev && next != current && !current->on_rq) {
+		if (prev->wakeup_time != U64_MAX
+			&& RB_EMPTY_NODE(&prev->sleeper)) {
+			enqueue_sleeper(prev, smp_processor_id());
+			tense_trace(sleep, SLEEP, prev, prev->vtime,
+				prev->wakeup_time);
+
+			// Otherwise @next programs the timer at its factor below
+			if (!task || task->experiment != prev->experiment)
+				program_sleepers(prev->experiment,
+					smp_processor_id(), NULL);
+
+			// It may have been the last one running
+			if (prev->experiment->fast_forward)
+				hrtimer_start(&prev->experiment->forward_timer,
+					prev->experiment->fast_forward,
+					HRTIMER_MODE_REL);
+		} else if (current->in_iowait && !prev->io_start) {
+			// Blocks on I/O, io_finish charges it when it is over
+			prev->io_start = local_clock();
+			prev->io_vtime = prev->vtime;
+		}
+	}
+
+	// Only the time a fault spends on the CPU is part of its real cost
+	if (unlikely(prev && prev->fault_depth) && next != current)
+		prev->fault_exec += local_clock() - prev->fault_start;
+
+	if (!task)
+		return;
+
+	if (unlikely(task->fault_depth) && next != current)
+		task->fault_start = local_clock();
+
+	// Woken through a futex by a task which was further in virtual time
+	task->vtime = max(task->vtime, READ_ONCE(task->wake_vtime));
+
+	// Nothing sampled while the task was away belongs to it
+	if (unlikely(task->kernel_tdf || task->irq_tdf))
+		sync_split(task, next);
+
+	tl = this_timeline(task);
+	task->vtime = tl->time;
+	check_tdf(task);
+	tense_vvar_publish(task->experiment->vvar, smp_processor_id(),
+		tl->time, task);
+
+	tense_trace(switch, SWITCH, task, tl->time, task->index);
+
+	// The timeline goes on at the factor of @next
+	if (cpumask_test_cpu(smp_processor_id(), task->experiment->sleepers_mask))
+		program_sleepers(task->experiment, smp_processor_id(), task);
+
+	if (unlikely(task->experiment->replay))
+		replay_switch(task);
+
+	if (unlikely(task->experiment->deterministic)
+		&& !det_first(task->experiment, task))
+		det_yield(task);
+}
+
+/*
+ * Virtual time as seen by current which must be a tense task.
+ */
+static u64 tense_current_time (void)
+{
+	struct tense_task *task = current->tense_task;
+	u64 time;
+
+	time = max(cpu_time(task->experiment, get_cpu()), task->vtime);
+	put_cpu();
+
+	return time;
+}
+
+/*
+ * Assumes current is a tense_task
+ */
+static void set_current_tdf (u32 faster, u32 slower) {
+	struct tense_task *task = current->tense_task;
+	u64 time;
+
+	/*
+	 * Account the time current has run so far at the old scale, without
+	 * giving up the CPU.
+	 */
+	tense_update_curr();
+
+	local_irq_disable();
+	task->base_faster = faster;
+	task->base_slower = slower;
+	set_task_warp(task);
+	time = this_timeline(task)->time;
+	tense_vvar_publish(task->experiment->vvar, smp_processor_id(),
+		time, task);
+	tense_trace(tdf, TDF, task, time,
+		(u64) task->faster << 32 | task->slower);
+	if (cpumask_test_cpu(smp_processor_id(), task->experiment->sleepers_mask))
+		program_sleepers(task->experiment, smp_processor_id(), task);
+	local_irq_enable();
+}
+
+/*
+ * Sleep until the virtual time of current reaches @wakeup_time, or a signal
+ * arrives.
+ */
+static void
+current_sleep_until(u64 wakeup_time)
+{
+	struct tense_task *task = current->tense_task;
+
+	task->wakeup_time = wakeup_time;
+
+	do {
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule();
+	} while (task->wakeup_time != U64_MAX && !signal_pending(current));
+
+	__set_current_state(TASK_RUNNING);
+
+	// Woken up by a signal before the wakeup time
+	if (task->wakeup_time != U64_MAX) {
+		hrtimer_cancel(&task->wakeup_timer);
+		dequeue_sleeper(task);
+	}
+}
+
+static void
+current_sleep(u64 duration)
+{
+	current_sleep_until(tense_current_time() + duration);
+}
+
+/*
+ * Move current forward by @offset ns of real time at its time dilation factor,
+ * as if it had run for that long. The caller should schedule() afterwards so
+ * that other tasks get to run against the new vruntime.
+ */
+static void
+current_move(u64 offset)
+{
+	struct tense_task *task = current->tense_task;
+
+	current->se.vruntime += offset;
+
+	local_irq_disable();
+	advance_curr(task, offset, scale(offset, task));
+	tense_trace(move, MOVE, task, task->vtime, offset);
+	local_irq_enable();
+}
+
+static inline void record_wakeup_error(u64 error)
+{
+	int bucket = error ? min(ilog2(error) / 2 + 1, TENSE_WAKEUP_ERRORS - 1) : 0;
+
+	this_cpu_inc(stats.wakeup_error[bucket]);
+}
+
+/*
+ * Take the first sleeper of @sl which is due at virtual time @now off the
+ * queue and return a reference to its task_struct, NULL if there is none. One
+ * whose wakeup timer is already running is left to the timer. Once the lock is
+ * dropped a signal may wake the task up and it may even exit, so everything
+ * about its tense task happens here.
+ */
+static struct task_struct *
+pop_due_sleeper(struct tense_sleepers *sl, u64 now)
+{
+	struct tense_task *task;
+	struct task_struct *p;
+	struct rb_node *node;
+
+	raw_spin_lock(&sl->lock);
+
+	for (node = rb_first_cached(&sl->root); node; node = rb_next(node)) {
+		task = rb_entry(node, struct tense_task, sleeper);
+
+		if (task->wakeup_time > now)
+			break;
+
+		if (hrtimer_try_to_cancel(&task->wakeup_timer) >= 0) {
+			tense_trace(wakeup, WAKEUP, task, now, task->wakeup_time);
+			record_wakeup_error(now - task->wakeup_time);
+
+			p = task->task_struct;
+			get_task_struct(p);
+			__dequeue_sleeper(sl, task);
+			raw_spin_unlock(&sl->lock);
+			return p;
+		}
+	}
+
+	raw_spin_unlock(&sl->lock);
+
+	return NULL;
+}
+
+/*
+ * Wake up the sleepers of @cpu which are due at virtual time @now, then program
+ * the timer for the rest. Each task is woken up with the lock of the sleepers
+ * dropped, since switch_in takes it under the rq lock.
+ */
+static void
+wake_up_cpu_sleepers(struct tense_experiment *exp, int cpu, u64 now)
+{
+	struct tense_sleepers *sl = per_cpu_ptr(exp->sleepers, cpu);
+	struct tense_task *running = NULL;
+	struct task_struct *p;
+
+	while ((p = pop_due_sleeper(sl, now))) {
+		wake_up_process(p);
+		put_task_struct(p);
+		this_cpu_inc(stats.wakeups);
+	}
+
+	if (cpu == smp_processor_id() && current->tense_task
+		&& current->tense_task->experiment == exp)
+		running = current->tense_task;
+
+	program_sleepers(exp, cpu, running);
+}
+
+/*
+ * Program the timer of the sleepers of @cpu for the real time at which the
+ * first of them is due. @running is the task whose factor moves the timeline
+ * of @cpu from its last update on, which must be on this CPU. Without one the
+ * timeline is stalled or follows min_time, so the timer may well fire early
+ * and then programs itself again. Nothing here depends on the tick.
+ */
+static void program_sleepers(struct tense_experiment *exp, int cpu,
+	struct tense_task *running)
+{
+	struct tense_sleepers *sl = per_cpu_ptr(exp->sleepers, cpu);
+	struct rb_node *first;
+	u64 wakeup = U64_MAX, now, delay, elapsed;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&sl->lock, flags);
+	first = rb_first_cached(&sl->root);
+	if (first)
+		wakeup = rb_entry(first, struct tense_task, sleeper)->wakeup_time;
+	raw_spin_unlock_irqrestore(&sl->lock, flags);
+
+	if (wakeup == U64_MAX)
+		return;
+
+	now = cpu_time(exp, cpu);
+
+	if (running) {
+		delay = tense_wakeup_delay(wakeup, now, running->inv_mult,
+			running->inv_shift);
+		elapsed = local_clock() -
+			READ_ONCE(per_cpu_ptr(exp->timelines, cpu)->updated);
+		delay = delay > elapsed ? delay - elapsed : 0;
+	} else {
+		delay = wakeup > now ? wakeup - now : 0;
+	}
+
+	// Only @cpu itself pins the timer, another CPU must not keep it there
+	hrtimer_start(&sl->timer, ns_to_ktime(delay), cpu == smp_processor_id()
+		? HRTIMER_MODE_REL_PINNED : HRTIMER_MODE_REL);
+}
+
+static enum hrtimer_restart sleepers_timer(struct hrtimer *timer)
+{
+	struct tense_sleepers *sl =
+		container_of(timer, struct tense_sleepers, timer);
+	struct tense_experiment *exp = sl->experiment;
+	struct tense_task *task = current->tense_task;
+
+	// The timeline is only as recent as the last update of the running task
+	if (task && task->experiment == exp && sl->cpu == smp_processor_id())
+		tense_update_curr();
+
+	wake_up_cpu_sleepers(exp, sl->cpu, cpu_time(exp, sl->cpu));
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Sleepers are woken up by the CPU they sleep on. Those on CPUs which no longer
+ * run tasks of the experiment follow its minimum and are woken up by anyone.
+ */
+static void wake_up_sleepers(struct tense_experiment *exp)
+{
+	int cpu = smp_processor_id(), other;
+
+	if (cpumask_test_cpu(cpu, exp->sleepers_mask))
+		wake_up_cpu_sleepers(exp, cpu, cpu_time(exp, cpu));
+
+	for_each_cpu(other, exp->sleepers_mask) {
+		if (other != cpu && !cpu_tense(exp, other))
+			wake_up_cpu_sleepers(exp, other, READ_ONCE(exp->min_time));
+	}
+}
+
+/*
+ * Scale measured I/O time on @dev by @faster / @slower, e.g. 3 / 1 for storage
+ * three times as fast. A @dev of 0 sets the factor for any other device. I/O
+ * on devices without a factor takes no virtual time unless it is predicted.
+ */
+static int
+set_io_factor(struct tense_experiment *exp, dev_t dev, u32 faster, u32 slower)
+{
+	struct tense_io_factor *f, *free = NULL;
+	int i, err = 0;
+
+	spin_lock(&exp->io_lock);
+
+	for (i = 0; i < TENSE_IO_FACTORS; i++) {
+		f = &exp->io_factors[i];
+		if (f->mult && f->dev == dev)
+			break;
+		if (!f->mult && !free)
+			free = f;
+	}
+
+	if (i == TENSE_IO_FACTORS)
+		f = free;
+
+	if (f) {
+		f->dev = dev;
+		tense_scale_calc(&f->mult, &f->shift, slower, faster);
+	} else {
+		err = -ENOSPC;
+	}
+
+	spin_unlock(&exp->io_lock);
+
+	return err;
+}
+
+/*
+ * Virtual duration of I/O which took @measured ns of real time. A prediction
+ * wins over measurement and only applies to the next I/O.
+ */
+static u64 io_duration(struct tense_task *task, u64 measured)
+{
+	struct tense_experiment *exp = task->experiment;
+	struct tense_io_factor *f, *any = NULL;
+	u64 duration = 0;
+	int i;
+
+	if (task->next_io_duration) {
+		duration = task->next_io_duration;
+		task->next_io_duration = 0;
+		return duration;
+	}
+
+	spin_lock(&exp->io_lock);
+
+	for (i = 0; i < TENSE_IO_FACTORS; i++) {
+		f = &exp->io_factors[i];
+		if (!f->mult)
+			continue;
+		if (f->dev == task->io_dev)
+			break;
+		if (!f->dev)
+			any = f;
+	}
+
+	f = i < TENSE_IO_FACTORS ? &exp->io_factors[i] : any;
+	if (f)
+		duration = tense_scale_apply(measured, f->mult, f->shift);
+
+	spin_unlock(&exp->io_lock);
+
+	return duration;
+}
+
+/*
+ * Make current, @task, wait until its virtual time reaches @end like a sleeper,
+ * so that it resumes in order with the other tense tasks. The wakeup timer
+ * makes sure it does even if nobody else moves virtual time forward.
+ */
+static void current_wait_until(struct tense_task *task, u64 end)
+{
+	u64 now = tense_current_time();
+
+	if (now < end) {
+		hrtimer_start(&task->wakeup_timer,
+			ns_to_ktime(scale_inv(end - now, task)),
+			HRTIMER_MODE_REL);
+		current_sleep_until(end);
+	}
+
+	task->vtime = max(task->vtime, end);
+}
+
+/*
+ * Called from io_schedule_finish once a task is done waiting for I/O. The real
+ * time it blocked never reaches its virtual time. Instead it is charged the
+ * virtual duration of the I/O, which it waits for. I/O within a page fault is
+ * left to fault_finish, which may replace it with a modelled cost.
+ */
+static void io_finish(void)
+{
+	struct tense_task *task = current->tense_task;
+	u64 duration;
+
+	if (!task || !task->io_start)
+		return;
+
+	duration = io_duration(task, local_clock() - task->io_start);
+	task->io_start = 0;
+
+	if (task->fault_depth) {
+		task->fault_io += duration;
+		return;
+	}
+
+	if (duration)
+		current_wait_until(task, task->io_vtime + duration);
+}
+
+/*
+ * Called from the futex code when current wakes @p, e.g. on the release of a
+ * contended mutex, with the hash bucket lock held. The real time @p spent
+ * waiting only reflects how long current took in real time to get here. What
+ * @p waited for in virtual time is current reaching its present virtual time,
+ * so that is where @p resumes, see switch_in. This keeps the virtual critical
+ * path through locks right for any time dilation factors.
+ */
+static void futex_wake(struct task_struct *p)
+{
+	struct tense_task *waker = current->tense_task;
+	struct tense_task *task;
+	u64 time;
+
+	if (!futex_sync || !waker)
+		return;
+
+	// Include what current has run since the last tick
+	tense_update_curr();
+	time = tense_current_time();
+
+	rcu_read_lock();
+	task = READ_ONCE(p->tense_task);
+	if (task && task->experiment == waker->experiment) {
+		if (time > READ_ONCE(task->wake_vtime))
+			WRITE_ONCE(task->wake_vtime, time);
+		this_cpu_inc(stats.futex_wakes);
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Submitting a bio is where I/O can be attributed to a device. The block layer
+ * doesn't export the tracepoint, so it is looked up by name.
+ */
+static struct tracepoint *bio_queue_tp;
+
+static void
+probe_bio_queue(void *data, struct request_queue *q, struct bio *bio)
+{
+	struct tense_task *task = current->tense_task;
+
+	if (task)
+		task->io_dev = bio_dev(bio);
+}
+
+static void find_bio_queue(struct tracepoint *tp, void *priv)
+{
+	if (!strcmp(tp->name, "block_bio_queue"))
+		bio_queue_tp = tp;
+}
+
+/* SECTION Virtual time synchronisation */
+
+/*
+ * Earliest virtual time a task sleeping in virtual time wakes up, U64_MAX if
+ * there is none.
+ */
+static u64 earliest_wakeup(struct tense_experiment *exp)
+{
+	struct tense_sleepers *sl;
+	struct rb_node *first;
+	u64 earliest = U64_MAX;
+	unsigned long flags;
+	int cpu;
+
+	for_each_cpu(cpu, exp->sleepers_mask) {
+		sl = per_cpu_ptr(exp->sleepers, cpu);
+
+		raw_spin_lock_irqsave(&sl->lock, flags);
+		first = rb_first_cached(&sl->root);
+		if (first)
+			earliest = min(earliest, rb_entry(first, struct tense_task,
+				sleeper)->wakeup_time);
+		raw_spin_unlock_irqrestore(&sl->lock, flags);
+	}
+
+	return earliest;
+}
+
+/*
+ * Virtual time up to which a task running on @cpu may go before it has to wait
+ * for the rest of the experiment, see tense_sync_horizon. For lookahead the
+ * other CPUs are those running tasks of the experiment other than @cpu, so a
+ * single running task doesn't wait for min_time, which is its own time.
+ */
+static u64 sync_horizon(struct tense_experiment *exp, int cpu)
+{
+	u64 lookahead = U64_MAX;
+	int other;
+
+	if (exp->sync_type == TENSE_SYNC_LOOKAHEAD) {
+		lookahead = earliest_wakeup(exp);
+		for_each_cpu(other, exp->tense_mask) {
+			if (other != cpu)
+				lookahead = min(lookahead, READ_ONCE(
+					per_cpu_ptr(exp->timelines, other)->time));
+		}
+	}
+
+	return tense_sync_horizon(exp->sync_type, READ_ONCE(exp->min_time),
+		exp->sync_bound, lookahead);
+}
+
+/*
+ * Whether current is ahead of the rest of @exp and has to wait. False once it
+ * has left the experiment or the experiment has no running CPUs to wait for.
+ */
+static bool sync_ahead(struct tense_experiment *exp)
+{
+	struct tense_task *task;
+	bool ahead = false;
+
+	rcu_read_lock();
+	task = READ_ONCE(current->tense_task);
+	if (task && task->experiment == exp && !cpumask_empty(exp->tense_mask))
+		ahead = task->vtime > sync_horizon(exp, raw_smp_processor_id());
+	rcu_read_unlock();
+
+	return ahead;
+}
+
+/*
+ * Make @p run @func on its way back to user space, where it can wait. The
+ * scheduler hooks can't sleep, nor can they hold a task back by themselves
+ * since CFS would just pick it again. The func of tense_work is only set while
+ * it is queued or running, so false means that @p already has one pending.
+ */
+static bool queue_tense_work(struct task_struct *p, task_work_func_t func)
+{
+	if (cmpxchg(&p->tense_work.func, NULL, func))
+		return false;
+
+	if (!try_module_get(THIS_MODULE))
+		goto bad_get;
+
+	if (tense_task_work_add(p, &p->tense_work))
+		goto bad_add;
+
+	return true;
+
+bad_add:
+	module_put(THIS_MODULE);
+
+bad_get:
+	WRITE_ONCE(p->tense_work.func, NULL);
+	return false;
+}
+
+// The last thing a tense_work does
+static void finish_tense_work(void)
+{
+	WRITE_ONCE(current->tense_work.func, NULL);
+	module_put(THIS_MODULE);
+}
+
+/*
+ * Called from the tick for current, which waits in sync_throttle if it is
+ * ahead.
+ */
+static void throttle_current(struct tense_task *task)
+{
+	struct tense_experiment *exp = task->experiment;
+	u64 horizon = sync_horizon(exp, smp_processor_id());
+
+	if (task->vtime <= horizon)
+		return;
+
+	if (!queue_tense_work(current, sync_throttle))
+		return;
+
+	this_cpu_inc(stats.throttles);
+	atomic64_inc(&exp->throttles);
+	tense_trace(throttle, THROTTLE, task, task->vtime, horizon);
+}
+
+/*
+ * Wait in task context until the others catch up. The waiting task doesn't
+ * advance any timeline, so min_time moves on with the other CPUs and also when
+ * the timeline of this one goes stale. update_min_time runs here as well in
+ * case no other task of the experiment ticks.
+ */
+static void sync_throttle(struct callback_head *work)
+{
+	struct tense_experiment *exp = NULL;
+	struct tense_task *task;
+	u64 start = local_clock();
+
+	rcu_read_lock();
+	task = READ_ONCE(current->tense_task);
+	if (task && kref_get_unless_zero(&task->experiment->ref))
+		exp = task->experiment;
+	rcu_read_unlock();
+
+	if (!exp)
+		goto out;
+
+	while (sync_ahead(exp) && !signal_pending(current)) {
+		wait_event_interruptible_timeout(exp->sync_wait,
+			!sync_ahead(exp), 1);
+		update_min_time(exp);
+	}
+
+	atomic64_add(local_clock() - start, &exp->throttled_ns);
+	put_experiment(exp);
+
+out:
+	finish_tense_work();
+}
+
+/* SECTION Schedule replay */
+
+static void free_replay(struct tense_replay *rp)
+{
+	if (!rp)
+		return;
+
+	kvfree(rp->entries);
+	kfree(rp);
+}
+
+/*
+ * Whether it is the turn of @task in @rp, taking the entry of the schedule if
+ * it is. A task comes back after its own entry when something outside the
+ * experiment ran in between, which the schedule doesn't show, so that is
+ * still its turn. Anyone may run once the replay is over.
+ */
+static bool replay_claim(struct tense_replay *rp, struct tense_task *task)
+{
+	const struct tense_replay_entry *e;
+	u32 c = atomic_read(&rp->cursor);
+
+	if (c >= rp->nr)
+		return true;
+
+	e = &rp->entries[c];
+	if (e->index == task->index) {
+		if (atomic_cmpxchg(&rp->cursor, c, c + 1) == c)
+			atomic64_add(task->vtime > e->time ?
+				task->vtime - e->time : e->time - task->vtime,
+				&rp->skew_ns);
+		return true;
+	}
+
+	return c && rp->entries[c - 1].index == task->index;
+}
+
+/*
+ * The task with @index waited too long for its turn, probably on one which
+ * waits for it in turn since the run took a different path. Skip ahead to its
+ * next entry, or to the end if it has none.
+ */
+static void replay_skip(struct tense_replay *rp, u32 index)
+{
+	u32 c = atomic_read(&rp->cursor), next = c;
+
+	while (next < rp->nr && rp->entries[next].index != index)
+		next++;
+
+	if (atomic_cmpxchg(&rp->cursor, c, next) == c)
+		atomic64_add(next - c, &rp->diverged);
+}
+
+/*
+ * Called from switch_in for @task of an experiment which replays a schedule.
+ * If it is not its turn it waits in replay_wait as soon as it gets to user
+ * space, letting the others run.
+ */
+static void replay_switch(struct tense_task *task)
+{
+	struct tense_replay *rp = task->experiment->replay;
+
+	if (!replay_claim(rp, task) && queue_tense_work(task->task_struct,
+			replay_wait))
+		atomic64_inc(&rp->waits);
+}
+
+/*
+ * Wait in task context for the turn of current. Nobody wakes it up, since the
+ * cursor moves in switch_in where that isn't possible, so it polls every tick.
+ * After replay_timeout_ms it skips the entries before its own instead.
+ */
+static void replay_wait(struct callback_head *work)
+{
+	struct tense_experiment *exp = NULL;
+	struct tense_task *task;
+	u64 deadline = local_clock() + replay_timeout_ms * NSEC_PER_MSEC;
+	bool turn;
+	u32 index = 0;
+
+	rcu_read_lock();
+	task = READ_ONCE(current->tense_task);
+	if (task && kref_get_unless_zero(&task->experiment->ref)) {
+		exp = task->experiment;
+		index = task->index;
+	}
+	rcu_read_unlock();
+
+	if (!exp)
+		goto out;
+
+	while (!signal_pending(current)) {
+		rcu_read_lock();
+		task = READ_ONCE(current->tense_task);
+		turn = !task || task->experiment != exp
+			|| replay_claim(exp->replay, task);
+		rcu_read_unlock();
+
+		if (turn)
+			break;
+
+		if (local_clock() > deadline) {
+			replay_skip(exp->replay, index);
+			continue;
+		}
+
+		schedule_timeout_interruptible(1);
+	}
+
+	put_experiment(exp);
+
+out:
+	finish_tense_work();
+}
+
+/*
+ * The schedule grows in whole entries as it is written, doubling the space
+ * each time it runs out.
+ */
+static inline u32 replay_capacity(u32 nr)
+{
+	return nr ? roundup_pow_of_two(nr) : 0;
+}
+
+static int
+open_replay(struct inode *inode, struct file *filp)
+{
+	if (!(filp->f_mode & FMODE_WRITE) || (filp->f_mode & FMODE_READ))
+		return -EINVAL;
+
+	filp->private_data = kzalloc(sizeof(struct tense_replay), GFP_KERNEL);
+	if (!filp->private_data)
+		return -ENOMEM;
+
+	return nonseekable_open(inode, filp);
+}
+
+/*
+ * Writes append struct tense_replay_entry records to the schedule, which
+ * becomes the schedule of the next experiment when the file is closed. Closing
+ * it without writing anything clears a schedule which no experiment took yet.
+ */
+static ssize_t
+write_replay(struct file *filp, const char __user *buf, size_t count,
+	loff_t *offset)
+{
+	struct tense_replay *rp = filp->private_data;
+	struct tense_replay_entry *entries;
+	size_t n = count / sizeof(*entries);
+	u32 cap, i;
+
+	if (count % sizeof(*entries) || n > TENSE_REPLAY_MAX - rp->nr)
+		return -EINVAL;
+
+	cap = replay_capacity(rp->nr);
+	if (rp->nr + n > cap) {
+		cap = replay_capacity(rp->nr + n);
+		entries = kvmalloc_array(cap, sizeof(*entries), GFP_KERNEL);
+		if (!entries)
+			return -ENOMEM;
+
+		if (rp->nr)
+			memcpy(entries, rp->entries, rp->nr * sizeof(*entries));
+		kvfree(rp->entries);
+		rp->entries = entries;
+	}
+
+	if (copy_from_user(rp->entries + rp->nr, buf, count))
+		return -EFAULT;
+
+	for (i = rp->nr; i < rp->nr + n; i++) {
+		if (rp->entries[i].reserved)
+			return -EINVAL;
+	}
+
+	rp->nr += n;
+
+	return count;
+}
+
+static int
+release_replay(struct inode *inode, struct file *filp)
+{
+	struct tense_replay *rp = filp->private_data;
+
+	if (!rp->nr) {
+		free_replay(rp);
+		rp = NULL;
+	}
+
+	free_replay(xchg(&replay_next, rp));
+	return 0;
+}
+
+static const struct file_operations tense_replay_fops = {
+	.owner          = THIS_MODULE,
+	.open           = open_replay,
+	.write          = write_replay,
+	.llseek         = no_llseek,
+	.release        = release_replay,
+};
+
+/* SECTION Deterministic dispatch */
+
+/*
+ * Whether @a comes before @b in virtual time, ties broken by the order in
+ * which they joined so that two runs agree.
+ */
+static inline bool det_before(struct tense_task *a, struct tense_task *b)
+{
+	u64 va = READ_ONCE(a->vtime), vb = READ_ONCE(b->vtime);
+
+	return va < vb || (va == vb && a->index < b->index);
+}
+
+/*
+ * Whether it is the turn of @task in deterministic mode: no other task of @exp
+ * which is runnable, or waits for its turn, comes before it. Tasks blocked on
+ * anything else don't count, they take part again once they are woken. This
+ * walks all tasks, which is fine for the small experiments the mode is for.
+ */
+static bool det_first(struct tense_experiment *exp, struct tense_task *task)
+{
+	struct tense_task *other;
+	int i;
+
+	rcu_read_lock();
+	for (i = 0; i < ARRAY_SIZE(exp->tasks); i++) {
+		list_for_each_entry_rcu(other, &exp->tasks[i].list, list) {
+			if (other == task)
+				continue;
+
+			if (READ_ONCE(other->task_struct->state) != TASK_RUNNING
+				&& !READ_ONCE(other->det_waiting))
+				continue;
+
+			if (det_before(other, task)) {
+				rcu_read_unlock();
+				return false;
+			}
+		}
+	}
+	rcu_read_unlock();
+
+	return true;
+}
+
+/*
+ * Whether current, which waits in det_wait, may go on. It may as well once it
+ * has left @exp.
+ */
+static bool det_current_first(struct tense_experiment *exp)
+{
+	struct tense_task *task;
+	bool first;
+
+	rcu_read_lock();
+	task = READ_ONCE(current->tense_task);
+	first = !task || task->experiment != exp || det_first(exp, task);
+	rcu_read_unlock();
+
+	return first;
+}
+
+static void set_current_det_waiting(struct tense_experiment *exp, bool waiting)
+{
+	struct tense_task *task;
+
+	rcu_read_lock();
+	task = READ_ONCE(current->tense_task);
+	if (task && task->experiment == exp)
+		WRITE_ONCE(task->det_waiting, waiting);
+	rcu_read_unlock();
+}
+
+/*
+ * Let tasks which come before @task run first. Called from switch_in and the
+ * tick, @task then waits in det_wait on its way back to user space.
+ */
+static void det_yield(struct tense_task *task)
+{
+	if (queue_tense_work(task->task_struct, det_wait))
+		atomic64_inc(&task->experiment->det_waits);
+}
+
+/*
+ * Wait in task context for the turn of current. A task which waits still
+ * counts for the others, so it wakes them up to check whether they are next
+ * now. Those which block otherwise can't do that from switch_in, so the
+ * waiters also check every tick.
+ */
+static void det_wait(struct callback_head *work)
+{
+	struct tense_experiment *exp = NULL;
+	struct tense_task *task;
+	u64 start = local_clock();
+
+	rcu_read_lock();
+	task = READ_ONCE(current->tense_task);
+	if (task && kref_get_unless_zero(&task->experiment->ref))
+		exp = task->experiment;
+	rcu_read_unlock();
+
+	if (!exp)
+		goto out;
+
+	set_current_det_waiting(exp, true);
+	wake_up_all(&exp->sync_wait);
+
+	while (!det_current_first(exp) && !signal_pending(current))
+		wait_event_interruptible_timeout(exp->sync_wait,
+			det_current_first(exp), 1);
+
+	set_current_det_waiting(exp, false);
+
+	atomic64_add(local_clock() - start, &exp->det_wait_ns);
+	put_experiment(exp);
+
+out:
+	finish_tense_work();
+}
+
+/* SECTION Idle fast-forward */
+
+/*
+ * Whether no task of @exp is runnable. Tasks waiting for their turn in
+ * deterministic mode or blocked on I/O count as busy, what the latter wait for
+ * happens in real time.
+ */
+static bool experiment_idle(struct tense_experiment *exp)
+{
+	struct tense_task *task;
+	int i;
+
+	rcu_read_lock();
+	for (i = 0; i < ARRAY_SIZE(exp->tasks); i++) {
+		list_for_each_entry_rcu(task, &exp->tasks[i].list, list) {
+			if (READ_ONCE(task->task_struct->state) == TASK_RUNNING
+				|| READ_ONCE(task->det_waiting)
+				|| READ_ONCE(task->io_start)) {
+				rcu_read_unlock();
+				return false;
+			}
+		}
+	}
+	rcu_read_unlock();
+
+	return true;
+}
+
+/*
+ * Armed for fast_forward whenever a task of the experiment goes to sleep. If
+ * none is runnable by then, nothing can happen in virtual time before the
+ * earliest wakeup, so the experiment jumps there like a discrete event
+ * simulator and the sleepers due wake up at once instead of after their
+ * scaled durations in real time. All timelines are stale at this point and
+ * their sleepers follow min_time from here on.
+ *
+ * A task which wakes up in the meantime must not find its CPU dropped from
+ * the mask while it runs. Tasks join timelines only outside of forward_seq,
+ * so one which wakes up after the idle check starts running after the jump,
+ * as if it had woken up at the new min_time. The timer never runs on two CPUs
+ * at once, so there is a single writer.
+ */
+static enum hrtimer_restart fast_forward(struct hrtimer *timer)
+{
+	struct tense_experiment *exp =
+		container_of(timer, struct tense_experiment, forward_timer);
+	u64 earliest = U64_MAX, min_time;
+	bool moved = false;
+	int cpu;
+
+	write_seqcount_begin(&exp->forward_seq);
+	if (experiment_idle(exp))
+		earliest = earliest_wakeup(exp);
+	if (earliest != U64_MAX) {
+		cpumask_clear(exp->tense_mask);
+		moved = advance_min_time(exp, earliest, &min_time);
+	}
+	write_seqcount_end(&exp->forward_seq);
+
+	if (earliest == U64_MAX)
+		return HRTIMER_NORESTART;
+
+	if (moved) {
+		atomic64_inc(&exp->forwards);
+		atomic64_add(earliest - min_time, &exp->forward_ns);
+		trace_tense_forward(exp, earliest - min_time);
+		tense_experiment_event(TENSE_EVENT_FORWARD, earliest,
+			earliest - min_time);
+		min_time = earliest;
+
+		if (wq_has_sleeper(&exp->sync_wait))
+			wake_up_all(&exp->sync_wait);
+	}
+
+	for_each_cpu(cpu, exp->sleepers_mask)
+		wake_up_cpu_sleepers(exp, cpu, min_time);
+
+	return HRTIMER_NORESTART;
+}
+
+/* SECTION Tense-aware balancing */
+
+/*
+ * Where @task stands after it moves to @cpu, by the same join as this_timeline
+ * once it runs there. Timelines of other CPUs are read without their locks,
+ * which is good enough for a decision of the load balancer.
+ */
+static u64 migrate_vtime(struct tense_task *task, int cpu)
+{
+	struct tense_experiment *exp = task->experiment;
+
+	return tense_timeline_join(
+		READ_ONCE(per_cpu_ptr(exp->timelines, cpu)->time),
+		cpu_tense(exp, cpu), READ_ONCE(exp->min_time),
+		READ_ONCE(task->vtime));
+}
+
+/*
+ * Called by the load balancer before it pulls @p over to @dst_cpu. With
+ * balance on, a task only moves to a CPU whose timeline is within
+ * balance_bound of it either way: to a timeline ahead the task would skip
+ * virtual time, one behind would jump to the task along with the tasks and
+ * sleepers already there.
+ * A CPU without tasks of the experiment takes on the time of the task, so
+ * moving there is always fine. Wakeup placement is left to CFS, a task
+ * woken up on a distant timeline only gets pulled back here.
+ */
+static bool can_migrate(struct task_struct *p, int dst_cpu)
+{
+	struct tense_task *task;
+	struct tense_experiment *exp;
+	bool ok = true;
+	u64 vtime, time;
+
+	rcu_read_lock();
+	task = READ_ONCE(p->tense_task);
+	if (!task)
+		goto out;
+
+	exp = task->experiment;
+	if (!exp->balance || !cpu_tense(exp, dst_cpu))
+		goto out;
+
+	vtime = READ_ONCE(task->vtime);
+	time = READ_ONCE(per_cpu_ptr(exp->timelines, dst_cpu)->time);
+	ok = (time > vtime ? time - vtime : vtime - time) <= exp->balance_bound;
+	if (!ok)
+		atomic64_inc(&exp->migrations_refused);
+
+out:
+	rcu_read_unlock();
+	return ok;
+}
+
+/*
+ * Any change of CPU, whether by the load balancer, on wakeup or by affinity,
+ * goes through set_task_cpu and its tracepoint, so this is where migrations
+ * and the virtual time they skip are counted. The core doesn't export the
+ * tracepoint, so it is looked up by name.
+ */
+static struct tracepoint *migrate_tp;
+
+static void probe_migrate(void *data, struct task_struct *p, int dest_cpu)
+{
+	struct tense_task *task;
+	u64 vtime, jump;
+
+	if (task_cpu(p) == dest_cpu)
+		return;
+
+	rcu_read_lock();
+	task = READ_ONCE(p->tense_task);
+	if (task) {
+		vtime = READ_ONCE(task->vtime);
+		jump = migrate_vtime(task, dest_cpu) - vtime;
+
+		atomic64_inc(&task->experiment->migrations);
+		atomic64_add(jump, &task->experiment->migration_jump_ns);
+		tense_trace(migrate, MIGRATE, task, vtime, jump);
+	}
+	rcu_read_unlock();
+}
+
+static void find_migrate_tp(struct tracepoint *tp, void *priv)
+{
+	if (!strcmp(tp->name, "sched_migrate_task"))
+		migrate_tp = tp;
+}
+
+/* SECTION User, kernel and interrupt time */
+
+/*
+ * Samples of more than this much runtime are halved along with the runtime
+ * they split, so that the split follows what a task did lately rather than
+ * over its whole life.
+ */
+#define TENSE_SPLIT_WINDOW NSEC_PER_SEC
+
+/*
+ * Interrupt time of @cpu as far as the scheduler charges it to tasks. With
+ * CONFIG_IRQ_TIME_ACCOUNTING it leaves interrupts out of their runtime
+ * altogether, so there is none.
+ */
+static inline u64 cpu_irqtime(int cpu)
+{
+	if (IS_ENABLED(CONFIG_IRQ_TIME_ACCOUNTING))
+		return 0;
+
+	return kcpustat_cpu(cpu).cpustat[CPUTIME_IRQ]
+		+ kcpustat_cpu(cpu).cpustat[CPUTIME_SOFTIRQ];
+}
+
+/*
+ * Take the cputime of @p and the interrupt time of its CPU as the point from
+ * which split_exec samples them, when @p is switched in or starts splitting.
+ */
+static void sync_split(struct tense_task *task, struct task_struct *p)
+{
+	struct tense_split *sp = &task->split;
+
+	sp->utime = READ_ONCE(p->utime);
+	sp->stime = READ_ONCE(p->stime);
+	sp->irqtime = cpu_irqtime(task_cpu(p));
+}
+
+static void reset_split(struct tense_task *task, struct task_struct *p)
+{
+	memset(&task->split, 0, sizeof(task->split));
+	sync_split(task, p);
+}
+
+/*
+ * What is still to be charged of a @part out of @samples of the runtime @exec,
+ * given that @charged of it was charged already, and at most @limit.
+ */
+static inline u64
+split_share(u64 exec, u64 part, u64 samples, u64 charged, u64 limit)
+{
+	u64 share = mul_u64_u32_div(exec, (u32) part, (u32) samples);
+
+	return share > charged ? min(share - charged, limit) : 0;
+}
+
+/*
+ * How much of @delta_exec, which current has just run, was kernel and
+ * interrupt time. The scheduler measures runtime exactly but only tells user
+ * from kernel time at ticks, which charge a whole tick to utime or stime and,
+ * for interrupts, to the irq time of the CPU as well. So the runtime is divided
+ * in the ratio of the samples, the way cputime_adjust divides it for
+ * getrusage, and what was charged as kernel or interrupt time catches up with
+ * its share without ever going back.
+ */
+static void
+split_exec(struct tense_task *task, u64 delta_exec, u64 *kernel, u64 *irq)
+{
+	struct tense_split *sp = &task->split;
+	u64 utime = READ_ONCE(current->utime);
+	u64 stime = READ_ONCE(current->stime);
+	u64 irqtime = cpu_irqtime(smp_processor_id());
+	u64 dstime = stime - sp->stime;
+	u64 dirq = min(irqtime - sp->irqtime, dstime);
+	u64 samples;
+
+	sp->user += utime - sp->utime;
+	sp->kernel += dstime - dirq;
+	sp->irq += dirq;
+	sp->exec += delta_exec;
+	sp->utime = utime;
+	sp->stime = stime;
+	sp->irqtime = irqtime;
+
+	samples = sp->user + sp->kernel + sp->irq;
+	while (samples > TENSE_SPLIT_WINDOW) {
+		sp->user /= 2;
+		sp->kernel /= 2;
+		sp->irq /= 2;
+		sp->exec /= 2;
+		sp->kernel_exec /= 2;
+		sp->irq_exec /= 2;
+		samples = sp->user + sp->kernel + sp->irq;
+	}
+
+	// Until the first tick it all counts as user time
+	if (!samples) {
+		*kernel = *irq = 0;
+		return;
+	}
+
+	*kernel = split_share(sp->exec, sp->kernel, samples, sp->kernel_exec,
+		delta_exec);
+	*irq = split_share(sp->exec, sp->irq, samples, sp->irq_exec,
+		delta_exec - *kernel);
+
+	sp->kernel_exec += *kernel;
+	sp->irq_exec += *irq;
+}
+
+/*
+ * Virtual time for @delta_exec which current, @task, has just run. What tense
+ * itself took of it is left out. With a kernel or interrupt factor set, those
+ * parts are charged at their own factor and the rest at the factor of the
+ * task, so that application code can be made faster while the kernel stays
+ * the same.
+ */
+static u64 scale_exec(struct tense_task *task, u64 delta_exec)
+{
+	struct tense_stats *st = this_cpu_ptr(&stats);
+	u64 overhead, kernel, irq, vdelta;
+
+	if (task->overhead) {
+		overhead = min(task->overhead, delta_exec);
+		task->overhead -= overhead;
+		delta_exec -= overhead;
+		st->overhead_ns += overhead;
+	}
+
+	if (likely(!task->kernel_tdf && !task->irq_tdf))
+		return scale(delta_exec, task);
+
+	split_exec(task, delta_exec, &kernel, &irq);
+	st->kernel_ns += kernel;
+	st->irq_ns += irq;
+
+	vdelta = scale(delta_exec - kernel - irq, task);
+
+	if (task->kernel_tdf)
+		vdelta += tense_scale_apply(kernel, task->kernel_mult,
+			task->kernel_shift);
+	else
+		vdelta += scale(kernel, task);
+
+	if (task->irq_tdf)
+		vdelta += tense_scale_apply(irq, task->irq_mult,
+			task->irq_shift);
+	else
+		vdelta += scale(irq, task);
+
+	return vdelta;
+}
+
+/*
+ * Charge the time current spends in @mode at @faster / @slower, see
+ * TENSE_CMD_MODE_TDF. Like with set_current_tdf, what current ran so far is
+ * accounted at the old factors first.
+ */
+static int set_current_mode_tdf(u32 mode, u32 faster, u32 slower)
+{
+	struct tense_task *task = current->tense_task;
+	u64 tdf = (u64) faster << 32 | slower, mult = 0;
+	u32 shift = 0;
+
+	if (mode != TENSE_MODE_KERNEL && mode != TENSE_MODE_IRQ)
+		return -EINVAL;
+
+	if (!faster && slower)
+		return -EINVAL;
+
+	if (faster && slower)
+		tense_scale_calc(&mult, &shift, slower, faster);
+
+	tense_update_curr();
+
+	local_irq_disable();
+	if (!task->kernel_tdf && !task->irq_tdf)
+		reset_split(task, current);
+
+	if (mode == TENSE_MODE_KERNEL) {
+		task->kernel_tdf = tdf;
+		task->kernel_mult = mult;
+		task->kernel_shift = shift;
+	} else {
+		task->irq_tdf = tdf;
+		task->irq_mult = mult;
+		task->irq_shift = shift;
+	}
+	local_irq_enable();
+
+	return 0;
+}
+
+/*
+ * The system calls of tense are not part of the workload, so the real time
+ * they take is left out of the runtime of the caller. A call which gave up the
+ * CPU isn't counted, the little it ran before that is lost in the noise.
+ */
+struct tense_overhead {
+	u64		start;
+	unsigned long	switches;
+};
+
+static inline void overhead_enter(struct tense_overhead *oh)
+{
+	oh->switches = current->nvcsw + current->nivcsw;
+	oh->start = local_clock();
+}
+
+static inline void overhead_exit(struct tense_overhead *oh)
+{
+	struct tense_task *task = current->tense_task;
+	u64 delta = local_clock() - oh->start;
+
+	if (!task || current->nvcsw + current->nivcsw != oh->switches)
+		return;
+
+	// The tick adds its own overhead from interrupt context
+	local_irq_disable();
+	task->overhead += delta;
+	local_irq_enable();
+}
+
+/* SECTION Page fault cost model */
+
+// Bit of the arg of a fault event which marks a major fault
+#define TENSE_FAULT_MAJOR_BIT	BIT_ULL(63)
+
+/*
+ * Draw the cost of a fault from @cost. Each task has its own generator seeded
+ * by its index, so the same task gets the same costs in the same order on
+ * every run.
+ */
+static u64 draw_fault_cost(struct tense_task *task,
+	const struct tense_fault_cost *cost)
+{
+	u64 low;
+
+	if (!cost->spread)
+		return cost->ns;
+
+	low = cost->ns > cost->spread ? cost->ns - cost->spread : 0;
+
+	return low + mul_u64_u32_shr(cost->ns + cost->spread - low + 1,
+		prandom_u32_state(&task->fault_rnd), 32);
+}
+
+/*
+ * Wait in task context for a major fault, its modelled cost or the I/O of an
+ * unmodelled one, now that the fault has let go of mmap_sem.
+ */
+static void fault_wait(struct callback_head *work)
+{
+	struct tense_experiment *exp = NULL;
+	struct tense_task *task;
+	u64 end;
+
+	rcu_read_lock();
+	task = READ_ONCE(current->tense_task);
+	if (task && kref_get_unless_zero(&task->experiment->ref))
+		exp = task->experiment;
+	rcu_read_unlock();
+
+	if (!exp)
+		goto out;
+
+	end = xchg(&task->fault_end, 0);
+	if (end)
+		current_wait_until(task, end);
+
+	put_experiment(exp);
+
+out:
+	finish_tense_work();
+}
+
+/*
+ * Make current, @task, wait until @end on its way back to user space, unless
+ * it has to wait for something else there already and just skips ahead.
+ * handle_mm_fault still holds mmap_sem, so it must not sleep here.
+ */
+static void queue_fault_wait(struct tense_task *task, u64 end)
+{
+	task->fault_end = max(task->fault_end, end);
+	if (!queue_tense_work(current, fault_wait)
+		&& READ_ONCE(current->tense_work.func) != fault_wait)
+		task->vtime = max(task->vtime, xchg(&task->fault_end, 0));
+}
+
+/*
+ * Called from handle_mm_fault before the fault is handled. With fault_model
+ * on, the time the fault runs on the CPU is measured from here, see also
+ * switch_in, and I/O it blocks on is held back by io_finish.
+ */
+static void fault_start(void)
+{
+	struct tense_task *task = current->tense_task;
+	unsigned long flags;
+
+	if (!task->experiment->fault_model)
+		return;
+
+	local_irq_save(flags);
+	if (!task->fault_depth++) {
+		task->fault_exec = 0;
+		task->fault_io = 0;
+		task->fault_vtime = task->vtime;
+		task->fault_start = local_clock();
+	}
+	local_irq_restore(flags);
+}
+
+/*
+ * Called from handle_mm_fault with its result @ret. If the type of the fault
+ * is modelled, its real runtime is taken out of virtual time along with the
+ * I/O it waited for, and it is charged a cost from the model instead. A minor
+ * fault is work on the CPU, so the timeline moves on by its cost as if the
+ * task ran. A major fault waits for a device, so the task waits for its cost
+ * like for I/O and other tasks run in the meantime, see queue_fault_wait. A
+ * fault whose type isn't modelled waits for its I/O the same way. A fault to be
+ * retried is only charged once the retry is done, and that counts as major if
+ * the first try was.
+ */
+static void fault_finish(int ret)
+{
+	struct tense_task *task = current->tense_task;
+	struct tense_experiment *exp = task->experiment;
+	unsigned long flags;
+	bool retry = ret & VM_FAULT_RETRY;
+	int type;
+	u64 exec, cost;
+
+	if (!task->fault_depth)
+		return;
+
+	local_irq_save(flags);
+	if (--task->fault_depth) {
+		local_irq_restore(flags);
+		return;
+	}
+	exec = task->fault_exec + local_clock() - task->fault_start;
+	local_irq_restore(flags);
+
+	type = (ret & VM_FAULT_MAJOR) || task->fault_major
+		? TENSE_FAULT_MAJOR : TENSE_FAULT_MINOR;
+	task->fault_major = retry && type == TENSE_FAULT_MAJOR;
+
+	// Not modelled, its I/O is charged as io_finish would have
+	if (!(exp->fault_model & BIT(type))) {
+		if (task->fault_io)
+			queue_fault_wait(task, task->fault_vtime + task->fault_io);
+		return;
+	}
+
+	local_irq_save(flags);
+	task->overhead += exec;
+	local_irq_restore(flags);
+	atomic64_add(exec, &exp->fault_real_ns);
+
+	if (retry)
+		return;
+
+	cost = draw_fault_cost(task, &exp->fault_cost[type]);
+	atomic64_inc(&exp->faults[type]);
+	atomic64_add(cost, &exp->fault_virtual_ns);
+	tense_trace(fault, FAULT, task, task->fault_vtime,
+		type == TENSE_FAULT_MAJOR ? cost | TENSE_FAULT_MAJOR_BIT : cost);
+
+	if (type == TENSE_FAULT_MINOR) {
+		local_irq_save(flags);
+		advance_curr(task, 0, cost);
+		local_irq_restore(flags);
+		return;
+	}
+
+	queue_fault_wait(task, task->fault_vtime + cost);
+}
+
+/* SECTION Adaptive slowdown */
+
+/*
+ * The controller of @exp, run every adapt_ms from a workqueue. It slows the
+ * whole experiment down by a quarter while the lead of its furthest timeline
+ * over min_time exceeds adapt_lag or there are more runnable tense tasks than
+ * CPUs, and speeds it up by a sixteenth while the lead is below half of that,
+ * so it settles at the least slowdown the machine can keep accurate. Tasks
+ * compose the slowdown into their factor in their next hook, see check_tdf.
+ *
+ * Every change is traced with the speed of time actually seen by the tasks,
+ * a moving average of virtual over real execution time, so that results can
+ * be corrected afterwards. The controller stops once it holds the last
+ * reference to the experiment.
+ */
+static void adapt_experiment(struct work_struct *work)
+{
+	struct tense_experiment *exp = container_of(to_delayed_work(work),
+		struct tense_experiment, adapt_work);
+	struct tense_timeline *tl;
+	struct tense_task *task;
+	u64 exec = 0, vexec = 0, max_time = 0, min_time;
+	u32 adapt = exp->adapt, runnable = 0;
+	int cpu, i;
+
+	if (kref_read(&exp->ref) == 1 || !READ_ONCE(exp->adapt_ms)) {
+		put_experiment(exp);
+		return;
+	}
+
+	min_time = READ_ONCE(exp->min_time);
+
+	for_each_possible_cpu(cpu) {
+		tl = per_cpu_ptr(exp->timelines, cpu);
+		exec += READ_ONCE(tl->exec);
+		vexec += READ_ONCE(tl->vexec);
+		if (cpu_tense(exp, cpu))
+			max_time = max(max_time, READ_ONCE(tl->time));
+	}
+
+	for (i = 0; i < ARRAY_SIZE(exp->tasks); i++) {
+		spin_lock(&exp->tasks[i].lock);
+		list_for_each_entry(task, &exp->tasks[i].list, list)
+			runnable += READ_ONCE(task->task_struct->state)
+				== TASK_RUNNING;
+		spin_unlock(&exp->tasks[i].lock);
+	}
+
+	exp->lag = max_time > min_time ? max_time - min_time : 0;
+	exp->pressure = runnable * 1000 / num_online_cpus();
+
+	if (exec > exp->adapt_exec)
+		exp->speed = (3 * exp->speed + div64_u64(1000 *
+			(vexec - exp->adapt_vexec), exec - exp->adapt_exec)) / 4;
+	exp->adapt_exec = exec;
+	exp->adapt_vexec = vexec;
+
+	if (exp->lag > exp->adapt_lag || exp->pressure > 1000)
+		adapt = min(adapt + adapt / 4, max(adapt_max, 1U) * 1000);
+	else if (exp->lag < exp->adapt_lag / 2)
+		adapt = max(adapt - adapt / 16, 1000U);
+
+	if (adapt != exp->adapt) {
+		WRITE_ONCE(exp->adapt, adapt);
+		trace_tense_adapt(exp);
+		tense_experiment_event(TENSE_EVENT_ADAPT, min_time,
+			(u64) exp->id << 32 | adapt);
+	}
+
+	schedule_delayed_work(&exp->adapt_work,
+		msecs_to_jiffies(exp->adapt_ms));
+}
+
+/*
+ * Stop the controllers of all experiments, for unloading the module.
+ */
+static void stop_adapt(void)
+{
+	struct tense_experiment *exp, *found;
+
+	do {
+		found = NULL;
+
+		spin_lock(&experiments_lock);
+		list_for_each_entry(exp, &experiments, list) {
+			if (READ_ONCE(exp->adapt_ms)
+				&& kref_get_unless_zero(&exp->ref)) {
+				found = exp;
+				break;
+			}
+		}
+		spin_unlock(&experiments_lock);
+
+		if (!found)
+			break;
+
+		// A running controller drops its reference itself
+		WRITE_ONCE(found->adapt_ms, 0);
+		if (cancel_delayed_work_sync(&found->adapt_work))
+			put_experiment(found);
+		put_experiment(found);
+	} while (found);
+}
+
+/* SECTION Nop loop calibration */
+
+#define TENSE_CALIBRATE_NOPS	(1 << 20)
+#define TENSE_CALIBRATE_RUNS	5
+
+// Wait for a burst of frequency transitions to settle before calibrating
+#define TENSE_CALIBRATE_DELAY_MS	100
+
+static bool cpufreq_registered;
+
+/*
+ * Time tense_nops on this CPU and keep the fastest of a few runs, the others
+ * were interrupted. The first run only warms up the CPU. Takes a few ms.
+ */
+static unsigned long calibrate_nops(void)
+{
+	u64 start, delta, best = U64_MAX;
+	int i;
+
+	tense_nops(TENSE_CALIBRATE_NOPS);
+
+	for (i = 0; i < TENSE_CALIBRATE_RUNS; i++) {
+		preempt_disable();
+		start = local_clock();
+		tense_nops(TENSE_CALIBRATE_NOPS);
+		delta = local_clock() - start;
+		preempt_enable();
+
+		best = min(best, delta);
+		cond_resched();
+	}
+
+	return div64_u64((u64) TENSE_CALIBRATE_NOPS * NSEC_PER_MSEC,
+		max_t(u64, best, 1));
+}
+
+static void calibrate_work_fn(struct work_struct *work)
+{
+	WRITE_ONCE(nops_per_ms, calibrate_nops());
+}
+
+static DECLARE_DELAYED_WORK(calibrate_work, calibrate_work_fn);
+
+static int
+cpufreq_transition(struct notifier_block *nb, unsigned long val, void *data)
+{
+	if (val == CPUFREQ_POSTCHANGE)
+		mod_delayed_work(system_wq, &calibrate_work,
+			msecs_to_jiffies(TENSE_CALIBRATE_DELAY_MS));
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block cpufreq_nb = {
+	.notifier_call = cpufreq_transition,
+};
+
+/*
+ * Calibrate now unless nops_per_ms was given, and again on every change of
+ * frequency. Without cpufreq the first calibration stays.
+ */
+static void start_calibration(void)
+{
+	if (nops_per_ms)
+		return;
+
+	nops_per_ms = calibrate_nops();
+
+	cpufreq_registered = !cpufreq_register_notifier(&cpufreq_nb,
+		CPUFREQ_TRANSITION_NOTIFIER);
+}
+
+static void stop_calibration(void)
+{
+	if (cpufreq_registered)
+		cpufreq_unregister_notifier(&cpufreq_nb,
+			CPUFREQ_TRANSITION_NOTIFIER);
+
+	cancel_delayed_work_sync(&calibrate_work);
+}
+
+/* SECTION Cgroup membership */
+
+/*
+ * Tasks of bound cgroups are attached to one shared experiment when they are
+ * forked, and detached when they exit, without any help from user space. The
+ * experiment lives as long as any cgroup is bound or any task attached through
+ * one remains. Bindings change under cgroups_lock, fork and exit only look at
+ * them under RCU.
+ */
+static struct tense_cgroup __rcu *cgroups[TENSE_CGROUPS];
+static struct tense_experiment __rcu *cgroup_exp;
+static DEFINE_MUTEX(cgroups_lock);
+
+static struct tracepoint *fork_tp, *exit_tp;
+
+static void free_cgroup_rcu(struct rcu_head *rcu)
+{
+	struct tense_cgroup *cg = container_of(rcu, struct tense_cgroup, rcu);
+
+	cgroup_put(cg->cgrp);
+	kfree(cg);
+}
+
+static void release_cgroup(struct kref *ref)
+{
+	struct tense_cgroup *cg = container_of(ref, struct tense_cgroup, ref);
+
+	call_rcu(&cg->rcu, free_cgroup_rcu);
+}
+
+static void put_cgroup(struct tense_cgroup *cg)
+{
+	kref_put(&cg->ref, release_cgroup);
+}
+
+/*
+ * The first bound cgroup that @p is in, under rcu_read_lock.
+ */
+static struct tense_cgroup *find_cgroup(struct task_struct *p)
+{
+	struct tense_cgroup *cg;
+	int i;
+
+	for (i = 0; i < TENSE_CGROUPS; i++) {
+		cg = rcu_dereference(cgroups[i]);
+		if (cg && task_under_cgroup_hierarchy(p, cg->cgrp))
+			return cg;
+	}
+
+	return NULL;
+}
+
+/*
+ * Attach @p to the cgroup experiment if it is in a bound cgroup, under
+ * rcu_read_lock, so it may not sleep.
+ */
+static void attach_cgroup_task(struct task_struct *p)
+{
+	struct tense_experiment *exp = rcu_dereference(cgroup_exp);
+	struct tense_cgroup *cg;
+
+	if (!exp || (p->flags & PF_KTHREAD))
+		return;
+
+	cg = find_cgroup(p);
+	if (!cg || !kref_get_unless_zero(&exp->ref))
+		return;
+
+	if (!add_task(exp, p, cg, GFP_ATOMIC))
+		put_experiment(exp);
+}
 
-static unsigned long nops_per_ms = 500000;
-module_param(nops_per_ms, ulong, 0);
-MODULE_PARM_DESC(nops_per_ms, "how many iterations of the nop loop take \
-	approx. 1 ms; this value is acquired through calibration");
+/*
+ * Detach @p if it was attached through a cgroup and no file took it over.
+ * Whoever clears p->tense_task removes the task, so this may race with itself.
+ */
+static void detach_cgroup_task(struct task_struct *p)
+{
+	struct tense_task *task = READ_ONCE(p->tense_task);
 
-static u8 log_level = 1;
-module_param(log_level, byte, 0);
-MODULE_PARM_DESC(log_level, "how verbose the logging should be");
+	if (!task || !task->detach_on_exit)
+		return;
 
-/* SECTION Tense core */
+	if (cmpxchg(&p->tense_task, task, NULL) == task)
+		remove_task(task);
+}
 
 /*
- * This struct holds function pointers to hooks that exist in the
- * scheduler of a modified Linux kernel that supports tense. It's used for
- * ease of development - recompile the module only if no actual changes to
- * the logic of the hooks are needed.
+ * The child is already in its cgroup here, and not yet running.
  */
-extern struct tense_operations *tense;
-
-static void init (void);
+static void
+probe_fork(void *data, struct task_struct *parent, struct task_struct *child)
+{
+	rcu_read_lock();
+	attach_cgroup_task(child);
+	rcu_read_unlock();
+}
 
-static void add_current_task (void);
+static void probe_exit(void *data, struct task_struct *p)
+{
+	detach_cgroup_task(p);
+}
 
-static void remove_current_task(void);
+static void find_process_tps(struct tracepoint *tp, void *priv)
+{
+	if (!strcmp(tp->name, "sched_process_fork"))
+		fork_tp = tp;
+	else if (!strcmp(tp->name, "sched_process_exit"))
+		exit_tp = tp;
+}
 
-static u64 update_curr (u64 delta_exec);
+/*
+ * Bind the cgroup at @path on the default hierarchy with the given factor, or
+ * set the factor if it is bound already. Tasks which are in it already are
+ * attached right away. One that is about to exit may be attached after its
+ * exit probe has run, so it is detached again here.
+ */
+static int bind_cgroup(const char *path, u32 faster, u32 slower)
+{
+	struct tense_experiment *exp;
+	struct tense_cgroup *cg;
+	struct task_struct *g, *p;
+	struct cgroup *cgrp;
+	int i, slot = -1;
+	u64 tdf = (u64) faster << 32 | slower;
+
+	for (i = 0; i < TENSE_CGROUPS; i++) {
+		cg = rcu_dereference_protected(cgroups[i],
+			lockdep_is_held(&cgroups_lock));
+		if (!cg) {
+			if (slot < 0)
+				slot = i;
+		} else if (!strcmp(cg->path, path)) {
+			// Tasks pick it up in their next hook, see check_tdf
+			WRITE_ONCE(cg->tdf, tdf);
+			return 0;
+		}
+	}
 
-static void after_task_tick(struct task_struct *curr);
+	if (slot < 0)
+		return -ENOSPC;
 
-static void wake_up_sleepers(void);
+	cgrp = cgroup_get_from_path(path);
+	if (IS_ERR(cgrp))
+		return PTR_ERR(cgrp);
 
-static void set_current_tdf (u32 faster, u32 slower);
+	cg = kzalloc(sizeof(*cg), GFP_KERNEL);
+	if (!cg) {
+		cgroup_put(cgrp);
+		return -ENOMEM;
+	}
 
-static u64 tense_current_time (void);
+	cg->cgrp = cgrp;
+	kref_init(&cg->ref);
+	cg->tdf = tdf;
+	strscpy(cg->path, path, sizeof(cg->path));
+
+	exp = rcu_dereference_protected(cgroup_exp,
+		lockdep_is_held(&cgroups_lock));
+	if (!exp) {
+		exp = create_experiment();
+		if (!exp) {
+			put_cgroup(cg);
+			return -ENOMEM;
+		}
+		rcu_assign_pointer(cgroup_exp, exp);
+	}
 
-/* SECTION Macros to log information in hooks */
+	rcu_assign_pointer(cgroups[slot], cg);
 
-#define tense_log(level, format, ...) if (log_level >= level) \
-	printk(KERN_DEBUG "tense: " format "\n", ## __VA_ARGS__)
+	rcu_read_lock();
+	for_each_process_thread(g, p) {
+		if (p->tense_task || (p->flags & PF_EXITING))
+			continue;
 
-#define tense_log_add_current_task() \
-	tense_log(3,"add comm=%s pid=%d", current->comm, current->pid)
+		attach_cgroup_task(p);
 
-#define tense_log_set_current_tdf(f, s) \
-	tense_log(3,"set tdf faster=%d slower=%d", f, s)
+		smp_mb();
+		if (p->flags & PF_EXITING)
+			detach_cgroup_task(p);
+	}
+	rcu_read_unlock();
 
-#define tense_log_current_time(mono_v, exec_v, exec_r) \
-	tense_log(3, "mono_v=%llu exec_v=%llu exec_r=%llu", mono_v, exec_v, exec_r)
+	return 0;
+}
 
-#define tense_log_remove_current_task() \
-	tense_log(3,"remove comm=%s pid=%d", current->comm, current->pid)
+/*
+ * Stop attaching new tasks of the cgroup at @path. Tasks attached so far stay
+ * in the experiment at the factor they have until they exit.
+ */
+static int unbind_cgroup(const char *path)
+{
+	struct tense_experiment *exp;
+	struct tense_cgroup *cg;
+	int i, found = -1, bound = 0;
+
+	for (i = 0; i < TENSE_CGROUPS; i++) {
+		cg = rcu_dereference_protected(cgroups[i],
+			lockdep_is_held(&cgroups_lock));
+		if (!cg)
+			continue;
+
+		if (found < 0 && !strcmp(cg->path, path))
+			found = i;
+		else
+			bound++;
+	}
 
-#define tense_log_update_curr(se, delta) \
-	tense_log(2, "update_curr sum_exec_runtime=%llu vruntime=%llu delta_exec=%llu", \
-		se->sum_exec_runtime, se->vruntime, *delta)
+	if (found < 0)
+		return -ENOENT;
 
-#define tense_log_init_sleeper(se, expires) \
-	tense_log(3,"init_sleeper vruntime=%llu expires=%llu", \
-		se->vruntime, expires)
+	cg = rcu_dereference_protected(cgroups[found],
+		lockdep_is_held(&cgroups_lock));
+	RCU_INIT_POINTER(cgroups[found], NULL);
 
-#define tense_log_current_schedstats() tense_log(2, \
-	"[%llu] s:%llu e:%llu v:%llu S:%llu W:%llu I:%llu", \
-	tense_time, \
-	current->start_time, \
-	current->se.sum_exec_runtime, \
-	current->se.vruntime, \
-	current->se.statistics.sum_sleep_runtime, \
-	current->se.statistics.wait_sum, \
-	current->se.statistics.iowait_sum)
+	exp = rcu_dereference_protected(cgroup_exp,
+		lockdep_is_held(&cgroups_lock));
+	if (!bound)
+		RCU_INIT_POINTER(cgroup_exp, NULL);
 
-/* SECTION Tense single-core implementation */
+	// A fork may still be attaching a task to either
+	synchronize_rcu();
 
-static u64 tense_time;
+	// Its tasks still use the factor
+	put_cgroup(cg);
 
-// // per-cpu timeline
-// DEFINE_PER_CPU(u64, timelines);
+	if (!bound)
+		put_experiment(exp);
 
-// // cpus that have runnable tense tasks on
-// struct cpumask __cpu_tense_mask __read_mostly;
-// #define cpu_tense_mask ((const struct cpumask *)&__cpu_tense_mask);
+	return 0;
+}
 
 /*
- * Average speed of time
- *
- * t_(i+1) = (1 - weight) * t_i + weight * (faster / slower)
- *
- * In practice time_speed is shifted left by SHIFT to maintain precision, so
- *
- * st_(i+1) = ((1 - weight) << SHIFT) * (st_i >> SHIFT)
-	      + (weight << SHIFT) * (faster / slower)
- *
- * where weight is defined to be delta_exec / 10 ms
+ * Remove all tasks attached through a cgroup, for unloading the module. The
+ * hooks and probes must be gone already.
  */
-#define PRECISION 10
-#define INT_SHIFT 23 // 8 388 608 ns as a shift
-#define INTERVAL (1 << INT_SHIFT)
+static void detach_cgroup_tasks(void)
+{
+	struct tense_experiment *exp;
+	struct tense_task *task, *found;
+	int i;
 
-static u64 time_speed = 1 << PRECISION;
+	// No hook still runs on any of them
+	synchronize_sched();
+
+	do {
+		found = NULL;
+
+		spin_lock(&experiments_lock);
+		list_for_each_entry(exp, &experiments, list) {
+			for (i = 0; i < ARRAY_SIZE(exp->tasks) && !found; i++) {
+				spin_lock(&exp->tasks[i].lock);
+				list_for_each_entry(task, &exp->tasks[i].list, list) {
+					if (task->detach_on_exit) {
+						found = task;
+						break;
+					}
+				}
+				spin_unlock(&exp->tasks[i].lock);
+			}
+
+			if (found)
+				break;
+		}
+		spin_unlock(&experiments_lock);
+
+		if (found)
+			detach_cgroup_task(found->task_struct);
+	} while (found);
+}
+
+static void unbind_cgroups(void)
+{
+	struct tense_cgroup *cg;
+	int i;
+
+	mutex_lock(&cgroups_lock);
+	for (i = 0; i < TENSE_CGROUPS; i++) {
+		cg = rcu_dereference_protected(cgroups[i],
+			lockdep_is_held(&cgroups_lock));
+		if (cg)
+			unbind_cgroup(cg->path);
+	}
+	mutex_unlock(&cgroups_lock);
+}
 
 /*
- * Making tense_task->slower a power of 2 is an optimisation opportunity both
- * for this function and delta_exec scaling in other places. However, this is
- * probably best done at the library level (or the file_ops handlers).
+ * Bound cgroups with their factors, one per line.
  */
-static inline void time_speed_update(u64 delta_exec, u64 faster, u64 slower)
+static int
+cgroups_show(struct seq_file *m, void *v)
 {
-	u64 update, decay;
-
-	if (unlikely(delta_exec > INTERVAL)) {
-		time_speed = (faster << PRECISION) / slower;
-		return;
+	struct tense_experiment *exp;
+	struct tense_cgroup *cg;
+	int i;
+
+	mutex_lock(&cgroups_lock);
+
+	exp = rcu_dereference_protected(cgroup_exp,
+		lockdep_is_held(&cgroups_lock));
+	if (exp)
+		seq_printf(m, "experiment %d tasks %d\n", exp->id,
+			atomic_read(&exp->nr_tasks));
+
+	for (i = 0; i < TENSE_CGROUPS; i++) {
+		cg = rcu_dereference_protected(cgroups[i],
+			lockdep_is_held(&cgroups_lock));
+		if (cg)
+			seq_printf(m, "%s %u %u\n", cg->path,
+				(u32) (cg->tdf >> 32), (u32) cg->tdf);
 	}
 
-	update = ((delta_exec * faster) << PRECISION) / (slower << INT_SHIFT);
-	decay = ((INTERVAL - delta_exec) << PRECISION) >> INT_SHIFT;
+	mutex_unlock(&cgroups_lock);
 
-	time_speed = ((decay * time_speed) >> PRECISION) + update;
+	return 0;
 }
 
-static LIST_HEAD(tense_tasks);
-DEFINE_SPINLOCK(tense_tasks_lock);
-
-static void init (void)
+static int
+open_cgroups(struct inode *inode, struct file *filp)
 {
-	tense_time = 0;
-	tense->update_curr = &update_curr;
-	tense->after_task_tick = &after_task_tick;
+	return single_open(filp, cgroups_show, NULL);
 }
 
-static enum hrtimer_restart tense_wakeup_timer(struct hrtimer *timer)
+/*
+ * Writing "<path> <faster> <slower>" binds the cgroup at <path>, relative to
+ * the root of the cgroup2 mount, or changes its factor. Writing "<path>" alone
+ * unbinds it.
+ */
+static ssize_t
+write_cgroups(struct file *filp, const char __user *buf, size_t count,
+	loff_t *offset)
 {
-	struct tense_task *task =
-		container_of(timer, struct tense_task, wakeup_timer);
+	char line[TENSE_CGROUP_PATH + 24], path[TENSE_CGROUP_PATH];
+	u32 faster, slower;
+	int n, err;
 
-	// todo: check for early wakeup rel. to tense_time + delta from local
-	// and restart if needed
+	if (count >= sizeof(line))
+		return -EINVAL;
 
-	task->wakeup_time = U64_MAX;
-	wake_up_process(task->task_struct);
+	if (copy_from_user(line, buf, count))
+		return -EFAULT;
+	line[count] = '\0';
 
-	return HRTIMER_NORESTART;
+	// The width is TENSE_CGROUP_PATH - 1
+	n = sscanf(line, "%127s %u %u", path, &faster, &slower);
+
+	mutex_lock(&cgroups_lock);
+	if (n == 1)
+		err = unbind_cgroup(path);
+	else if (n == 3 && faster && slower)
+		err = bind_cgroup(path, faster, slower);
+	else
+		err = -EINVAL;
+	mutex_unlock(&cgroups_lock);
+
+	return err ? err : count;
 }
 
+static const struct file_operations tense_cgroups_fops = {
+	.owner          = THIS_MODULE,
+	.open           = open_cgroups,
+	.read           = seq_read,
+	.write          = write_cgroups,
+	.llseek         = seq_lseek,
+	.release        = single_release,
+};
 
-// static inline void
-// set_cpu_tense(unsigned int cpu, bool is_tense)
-// {
-// 	if (is_tense)
-// 		cpumask_set_cpu(cpu, &__cpu_tense_mask);
-// 	else
-// 		cpumask_clear_cpu(cpu, &__cpu_tense_mask);
-// }
+/* SECTION Statistics interface */
 
-static void add_current_task(void)
+static int
+stats_show(struct seq_file *m, void *v)
 {
-	struct tense_task *task;
-	// int cpuid = smp_processor_id();
-
-	// if (!cpu_tense(cpuid)) {
-	// 	this_cpu_write(timelines, tense_time);
-	// 	set_cpu_tense(cpuid, true);
-	// }
+	struct tense_experiment *exp;
+	struct tense_stats *st, sum = { 0 };
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(&stats, cpu);
+		sum.ticks += st->ticks;
+		sum.tick_ns += st->tick_ns;
+		sum.tick_max_ns = max(sum.tick_max_ns, st->tick_max_ns);
+		sum.wakeups += st->wakeups;
+		sum.futex_wakes += st->futex_wakes;
+		sum.slices_clamped += st->slices_clamped;
+		sum.throttles += st->throttles;
+		sum.kernel_ns += st->kernel_ns;
+		sum.irq_ns += st->irq_ns;
+		sum.overhead_ns += st->overhead_ns;
+		for (i = 0; i < TENSE_WAKEUP_ERRORS; i++)
+			sum.wakeup_error[i] += st->wakeup_error[i];
+	}
 
-	task = kmalloc(sizeof(*task), GFP_KERNEL);
+	seq_printf(m, "ticks %llu\n", sum.ticks);
+	seq_printf(m, "tick_ns %llu\n", sum.tick_ns);
+	seq_printf(m, "tick_max_ns %llu\n", sum.tick_max_ns);
+	seq_printf(m, "wakeups %llu\n", sum.wakeups);
+	seq_printf(m, "futex_wakes %llu\n", sum.futex_wakes);
+	seq_printf(m, "slices_clamped %llu\n", sum.slices_clamped);
+	seq_printf(m, "throttles %llu\n", sum.throttles);
+	seq_printf(m, "kernel_ns %llu\n", sum.kernel_ns);
+	seq_printf(m, "irq_ns %llu\n", sum.irq_ns);
+	seq_printf(m, "overhead_ns %llu\n", sum.overhead_ns);
+	seq_printf(m, "events_dropped %llu\n", tense_events_dropped());
+	seq_printf(m, "nops_per_ms %lu\n", READ_ONCE(nops_per_ms));
+
+	// One line per bucket which isn't empty, keyed by its lower bound in ns
+	for (i = 0; i < TENSE_WAKEUP_ERRORS; i++) {
+		if (sum.wakeup_error[i])
+			seq_printf(m, "wakeup_error_ns %llu %llu\n",
+				i ? 1ULL << (2 * (i - 1)) : 0, sum.wakeup_error[i]);
+	}
 
-	task->task_struct = current;
+	spin_lock(&experiments_lock);
+	list_for_each_entry(exp, &experiments, list) {
+		seq_printf(m, "experiment %d tasks %d min_time %llu adapt %u "
+			"speed %u lag %llu pressure %u throttles %lld "
+			"throttled_ns %lld\n", exp->id,
+			atomic_read(&exp->nr_tasks), READ_ONCE(exp->min_time),
+			READ_ONCE(exp->adapt), READ_ONCE(exp->speed),
+			READ_ONCE(exp->lag), READ_ONCE(exp->pressure),
+			atomic64_read(&exp->throttles),
+			atomic64_read(&exp->throttled_ns));
+	}
+	list_for_each_entry(exp, &experiments, list) {
+		if (!exp->deterministic)
+			continue;
 
-	task->wakeup_time = U64_MAX;
-	hrtimer_init(&task->wakeup_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	task->wakeup_timer.function = tense_wakeup_timer;
-	
-	task->faster = 1;
-	task->slower = 1;
+		seq_printf(m, "deterministic %d waits %lld wait_ns %lld\n",
+			exp->id, atomic64_read(&exp->det_waits),
+			atomic64_read(&exp->det_wait_ns));
+	}
+	list_for_each_entry(exp, &experiments, list) {
+		if (!exp->fast_forward)
+			continue;
 
-	task->next_io_duration = 0;
+		seq_printf(m, "forward %d jumps %lld skipped_ns %lld\n", exp->id,
+			atomic64_read(&exp->forwards),
+			atomic64_read(&exp->forward_ns));
+	}
+	list_for_each_entry(exp, &experiments, list) {
+		seq_printf(m, "migrate %d balance %d moves %lld jump_ns %lld "
+			"refused %lld\n", exp->id, exp->balance,
+			atomic64_read(&exp->migrations),
+			atomic64_read(&exp->migration_jump_ns),
+			atomic64_read(&exp->migrations_refused));
+	}
+	list_for_each_entry(exp, &experiments, list) {
+		if (!exp->fault_model)
+			continue;
+
+		seq_printf(m, "faults %d minor %lld major %lld real_ns %lld "
+			"virtual_ns %lld\n", exp->id,
+			atomic64_read(&exp->faults[TENSE_FAULT_MINOR]),
+			atomic64_read(&exp->faults[TENSE_FAULT_MAJOR]),
+			atomic64_read(&exp->fault_real_ns),
+			atomic64_read(&exp->fault_virtual_ns));
+	}
+	list_for_each_entry(exp, &experiments, list) {
+		if (!exp->replay)
+			continue;
+
+		seq_printf(m, "replay %d cursor %u entries %u waits %lld "
+			"diverged %lld skew_ns %lld\n", exp->id,
+			min_t(u32, atomic_read(&exp->replay->cursor),
+				exp->replay->nr), exp->replay->nr,
+			atomic64_read(&exp->replay->waits),
+			atomic64_read(&exp->replay->diverged),
+			atomic64_read(&exp->replay->skew_ns));
+	}
+	spin_unlock(&experiments_lock);
 
-	spin_lock(&tense_tasks_lock);
-	list_add(&task->list, &tense_tasks);
-	spin_unlock(&tense_tasks_lock);
+	return 0;
+}
 
-	current->tense_task = task;
-	
-	tense_log_add_current_task(); 
+static int
+open_stats(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, stats_show, NULL);
 }
 
-static void remove_current_task(void)
+/*
+ * Writing anything to the statistics file resets them.
+ */
+static ssize_t
+write_stats(struct file *filp, const char __user *buf, size_t count, loff_t *offset)
 {
-	struct tense_task *task = current->tense_task;
+	int cpu;
 
-	if (!task)
-		return;
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&stats, cpu), 0, sizeof(struct tense_stats));
+
+	return count;
+}
 
-	current->tense_task = NULL;
+static const struct file_operations tense_stats_fops = {
+	.owner          = THIS_MODULE,
+	.open           = open_stats,
+	.read           = seq_read,
+	.write          = write_stats,
+	.llseek         = seq_lseek,
+	.release        = single_release,
+};
 
-	tense_log_current_schedstats();
-	tense_log_remove_current_task();
-	
-	spin_lock(&tense_tasks_lock);
+/* SECTION File operations interface for tense. See libtense for user space */
 
-	list_del(&task->list);
-	if (list_empty(&tense_tasks))
-		tense_time = 0;
-	
-	spin_unlock(&tense_tasks_lock);
+/*
+ * The tense task which opened the file. Only that task may use it, so this is
+ * NULL for anyone else, e.g. a child which inherited the file descriptor.
+ */
+static inline struct tense_task *file_task(struct file *filp)
+{
+	struct tense_task *task = filp->private_data;
 
-	kfree(task);
+	return task == current->tense_task ? task : NULL;
 }
 
-#define scale(x, task) (((x) * (task->slower)) / (task->faster));
-#define scale_inv(x, task) (((x) * (task->faster)) / (task->slower));
+/*
+ * A process reads a struct timespec from the file to get its current virtual
+ * time. The file has no end, so every read returns a fresh value, which
+ * includes the time current has run since the last tick or switch.
+ */
+ssize_t
+read_tense(struct file *filp, char __user *buff, size_t count, loff_t *offp)
+{
+	struct timespec64 kernel_tp;
+	struct timespec __user *tp = (struct timespec __user *) buff;
+	struct tense_overhead oh;
+
+	if (!file_task(filp))
+		return -EPERM;
 
-static u64 update_curr(u64 delta_exec)
+	if (count < sizeof(*tp))
+		return -EINVAL;
+
+	overhead_enter(&oh);
+	tense_update_curr();
+	kernel_tp = ns_to_timespec64(tense_current_time());
+	overhead_exit(&oh);
+
+	if (put_timespec64(&kernel_tp, tp))
+		return -EFAULT;
+
+	return sizeof(*tp);
+}
+
+/*
+ * A process opens the file to start a tense experiment or join an existing one.
+ * Threads join the experiment of their process and processes that of their
+ * parent, see find_experiment. Opening with O_EXCL always starts a new
+ * experiment. Experiments are isolated from each other, each has its own
+ * timelines and sleepers. A task already attached through a cgroup keeps its
+ * experiment and from then on leaves it when it closes the file.
+ */
+static int
+open_tense(struct inode *inode, struct file *filp)
 {
+	struct tense_experiment *exp = NULL;
 	struct tense_task *task = current->tense_task;
-	
-	if (!task)
-		return delta_exec;
 
-	// Avg speed of time calculation (currently unused)
-	// time_speed_update(delta_exec, task->faster, task->slower);
+	// Attached through a cgroup, the file takes the task over
+	if (task && task->detach_on_exit) {
+		task->detach_on_exit = false;
+		filp->private_data = task;
+		return 0;
+	}
 
-	delta_exec = scale(delta_exec, task);
-	
-	tense_log(2, "[%llu] (%d) update by %llu | ts %llu %u %u", tense_time,
-		smp_processor_id(), delta_exec, time_speed, task->faster, task->slower);
+	if (task)
+		return -EBUSY;
 
-	tense_time += delta_exec;
+	if (!(filp->f_flags & O_EXCL))
+		exp = find_experiment();
 
-	/*
-	 * This is a call to update_curr from deactivate_task when the task is
-	 * about to sleep. Add the last delta_exec to get accurate wakeup_time.
-	 */
-	if (task->wakeup_time != U64_MAX) {
-		task->wakeup_time += delta_exec;
-		tense_log(2, "[%llu] sleep + %llu to %llu", tense_time, delta_exec, task->wakeup_time);
+	if (!exp)
+		exp = create_experiment();
+
+	if (!exp)
+		return -ENOMEM;
+
+	task = add_task(exp, current, NULL, GFP_KERNEL);
+	if (!task) {
+		put_experiment(exp);
+		return -ENOMEM;
 	}
 
-	return delta_exec;
+	filp->private_data = task;
+	return 0;
 }
 
 /*
- * This is a chance to do anything that needs to be atomic against schedule such
- * as waking up tasks. Interrupts are disabled.
+ * A process writes to the file to set its time dilation factor, which the top of
+ * its warp stack is composed with. Because there are no floats in the kernel we
+ * use two integers - (faster, slower).
  */
-static void after_task_tick(struct task_struct *curr)
+static ssize_t
+write_tense(struct file *filp, const char __user *buf, size_t count, loff_t *offset)
 {
-	if (!curr->tense_task)
-		return;
+	struct tense_overhead oh;
+	u32 tdf[2];
 
-	wake_up_sleepers();
-}
+	if (!file_task(filp))
+		return -EPERM;
 
-static u64 tense_current_time (void)
-{
-	return tense_time;
+	if (count < sizeof(tdf))
+		return -EINVAL;
+
+	if (copy_from_user(tdf, buf, sizeof(tdf)))
+		return -EFAULT;
+
+	if (!tdf[0] || !tdf[1])
+		return -EINVAL;
+
+	overhead_enter(&oh);
+	set_current_tdf(tdf[0], tdf[1]);
+	overhead_exit(&oh);
+
+	return count;
 }
 
 /*
- * Assumes current is a tense_task
+ * Run one command of a batch, see struct tense_cmd. Moves don't schedule()
+ * here, the batch does that once at the end.
  */
-static void set_current_tdf (u32 faster, u32 slower) {
-	tense_log_set_current_tdf(faster, slower);
+static int
+run_cmd(const struct tense_cmd *cmd, bool *moved)
+{
+	if (cmd->flags)
+		return -EINVAL;
 
-	/* 
-	 * Call schedule first so that update_curr uses the old scale.
-	 * This will also make sure process times are updated.
-	 */
-	schedule();
+	switch (cmd->type) {
+	case TENSE_CMD_TDF:
+		if (!cmd->tdf.faster || !cmd->tdf.slower)
+			return -EINVAL;
+		set_current_tdf(cmd->tdf.faster, cmd->tdf.slower);
+		break;
+	case TENSE_CMD_MOVE:
+		current_move(cmd->ns);
+		*moved = true;
+		break;
+	case TENSE_CMD_SLEEP:
+		current_sleep(cmd->ns);
+		break;
+	case TENSE_CMD_IO:
+		current->tense_task->next_io_duration = cmd->ns;
+		break;
+	case TENSE_CMD_IO_FACTOR:
+		if (!cmd->io_factor.faster || !cmd->io_factor.slower)
+			return -EINVAL;
+		return set_io_factor(current->tense_task->experiment,
+			new_decode_dev(cmd->io_factor.dev),
+			cmd->io_factor.faster, cmd->io_factor.slower);
+	case TENSE_CMD_MODE_TDF:
+		return set_current_mode_tdf(cmd->mode_tdf.mode,
+			cmd->mode_tdf.faster, cmd->mode_tdf.slower);
+	default:
+		return -EINVAL;
+	}
 
-	current->tense_task->faster = faster;
-	current->tense_task->slower = slower;       
+	return 0;
 }
 
-static void
-current_sleep(u64 duration)
+static long
+ioctl_batch(struct tense_batch __user *ubatch)
 {
-	struct tense_task *task = current->tense_task;
-
-	task->wakeup_time = tense_time + duration;
-
-	do {
-		set_current_state(TASK_INTERRUPTIBLE);
-		schedule();
-	} while (task->wakeup_time != U64_MAX && !signal_pending(current));
+	struct tense_cmd __user *ucmds;
+	struct tense_batch batch;
+	struct tense_cmd cmd;
+	bool moved = false;
+	long err = 0;
+	u32 i;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
 
-	__set_current_state(TASK_RUNNING);
+	if (batch.version != TENSE_ABI_VERSION || batch.reserved
+		|| batch.nr > TENSE_BATCH_MAX)
+		return -EINVAL;
 
-	// todo: what if woken up by a signal
-}
+	ucmds = u64_to_user_ptr(batch.cmds);
 
-#define latency 100000
-#define tick 4000000
-static void wake_up_sleepers(void)
-{
-	struct tense_task *task;
-	ktime_t scaled_wakeup;
-
-	spin_lock(&tense_tasks_lock);
-	list_for_each_entry(task, &tense_tasks, list) {
-		/*
-		 * If timer is not active (0), process was already woken up.
-		 * If timer is currently executing callback (-1), it will wake up.
-		 * Otherwise it's our job to call wake_up_process here.
-		 */
-		if (task->wakeup_time < tense_time
-			&& hrtimer_try_to_cancel(&task->wakeup_timer) == 1) {
-
-			tense_log(2, "[%llu] forced wake up %s(%d) %li expected %llu",
-				tense_time, task->task_struct->comm,
-				task->task_struct->pid, task->task_struct->state,
-				task->wakeup_time);
-
-			WARN_ON(tense_time - task->wakeup_time > 10 * latency);
-
-			task->wakeup_time = U64_MAX;
-			wake_up_process(task->task_struct);
-		}
-		else if (task->wakeup_time != U64_MAX
-			&& task->wakeup_time < tense_time + tick) {
-
-			/* We need to prepare for the worst case here. That is,
-			 * the current process runs for a whole tick without
-			 * interruption. However, it's simple because we only
-			 * need to account for constant time dilation (there
-			 * will be an update on change) and we can cancel the
-			 * timer.
-			 */
-
-			scaled_wakeup = task->wakeup_time - tense_time; 
-			if (current->tense_task)
-				scaled_wakeup = scale_inv(scaled_wakeup, current->tense_task);
-			
-			tense_log(2, "[%llu] set wake up %lli", tense_time, scaled_wakeup);
-
-			hrtimer_start(&task->wakeup_timer, scaled_wakeup, HRTIMER_MODE_REL);
+	for (i = 0; i < batch.nr; i++) {
+		if (copy_from_user(&cmd, &ucmds[i], sizeof(cmd))) {
+			err = -EFAULT;
+			break;
 		}
+
+		err = run_cmd(&cmd, &moved);
+		if (err)
+			break;
 	}
-	spin_unlock(&tense_tasks_lock);
-}
 
-/* SECTION File operations interface for tense. See libtense for user space */
+	if (moved)
+		schedule();
 
-/*
- * A process reads the file to get its current virtual time.
- */
-ssize_t
-read_tense(struct file *filp, char __user *buff, size_t count, loff_t *offp)
-{
-	struct timespec64 kernel_tp;
-	struct timespec *tp = (struct timespec *) buff;
+	batch.done = i;
+	batch.time = tense_current_time();
 
-	kernel_tp = ns_to_timespec64(tense_current_time());
-	
-	if(put_timespec64(&kernel_tp, tp))
+	if (copy_to_user(ubatch, &batch, sizeof(batch)))
 		return -EFAULT;
 
-	return 0;
+	return err;
 }
 
 /*
- * A process opens the file to start a tense experiment or join an existing one.
- * There can only be one experiment executing at a time.
+ * Control operations go through ioctl, see the control commands in
+ * tense_uapi.h. A batch of them costs a single system call.
  */
-static int
-open_tense(struct inode *inode, struct file *filp)
+static long
+ioctl_tense(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-	add_current_task();
+	struct tense_task *task = file_task(filp);
+	struct tense_overhead oh;
+	long ret;
 
-	// todo: error handling if current task cannot be added
-	return 0;
+	if (!task)
+		return -EPERM;
+
+	overhead_enter(&oh);
+
+	switch (cmd) {
+	case TENSE_IOC_BATCH:
+		ret = ioctl_batch((struct tense_batch __user *) arg);
+		break;
+	case TENSE_IOC_ID:
+		ret = put_user(task->index + 1, (__u32 __user *) arg);
+		break;
+	default:
+		ret = -ENOTTY;
+	}
+
+	overhead_exit(&oh);
+	return ret;
 }
 
 /*
- * A process writes to the file to set its time dilation factor. Because there
- * are no floats in the kernel we use two integers - (faster, slower).
+ * A process maps the file to read virtual time without a system call. The page
+ * is read-only, see struct tense_vvar for its layout. At TENSE_WARP_PGOFF the
+ * process instead maps its own warp stack, see struct tense_warp.
  */
-static ssize_t
-write_tense(struct file *filp, const char __user *buf, size_t count, loff_t *offset)
+static int
+mmap_tense(struct file *filp, struct vm_area_struct *vma)
 {
-	u32 faster, slower;
-	faster = *(u32 *)buf;
-	slower = *(((u32 *)buf) + 1);
+	struct tense_task *task = filp->private_data;
 
-	set_current_tdf(faster, slower);
+	if (vma->vm_pgoff == TENSE_WARP_PGOFF) {
+		task = file_task(filp);
+		return task ? tense_warp_mmap(task, vma) : -EPERM;
+	}
 
-	return count;
+	return tense_vvar_mmap(task->experiment->vvar, vma);
 }
 
 /*
  * Seeking is a bit weird. The file offset of the tense file is interpreted as
  * the time offset for the seeking process, or alternatively, the position of
- * this process on the virtual timeline. The returned value is tense_time after
+ * this process on the virtual timeline. The returned value is virtual time after
  * the requested operation completes.
  *
  *  - SEEK_SET  - set vruntime to @offset
  *  - SEEK_CUR  - add @offset to vruntime; the current time-dilation applies
  *  - SEEK_DATA - use @offset as the predicted I/O time for the next blocking
  *                I/O operation; the operation itself doesn't run within this
- *                call
+ *                call, it is charged @offset once it blocks, see io_finish
  *  - SEEK_HOLE - use @offset as the duration to sleep in virtual time starting
  *                right now; the current process is put to sleep immediately
+ *
+ * The same operations are available as commands of TENSE_IOC_BATCH, which can
+ * run several of them in one call.
  */
 static loff_t
 llseek_tense(struct file *filp, loff_t offset, int whence)
 {
+	if (!file_task(filp))
+		return -EPERM;
+
 	switch(whence) {
 	case SEEK_SET:
 		current->se.vruntime = offset;
 		schedule();
 		break;
 	case SEEK_CUR:
-		current->se.vruntime += offset;
-		update_curr(offset);
+		current_move(offset);
 		schedule();
 		break;
 	case SEEK_END:
@@ -453,18 +3612,18 @@ llseek_tense(struct file *filp, loff_t offset, int whence)
 		return -EINVAL;
 	}
 
-	return tense_time;
+	return tense_current_time();
 }
 
 /*
- * A process closes the file to exit from the experiment. The last process to
- * exit an experiment causes the timing state to be reset so that a new
- * experiment can start as soon as another process joins in.
+ * A process closes the file to exit from the experiment. The experiment goes
+ * away with its last process, so a process which opens the file after that
+ * starts a new one from 0.
  */
 static int
 release_tense (struct inode *inode, struct file *filp)
 {
-	remove_current_task();
+	remove_task(filp->private_data);
 	return 0;
 }
 
@@ -474,19 +3633,113 @@ static const struct file_operations tense_fops = {
 	.read           = read_tense,
 	.write          = write_tense,
 	.llseek         = llseek_tense,
+	.unlocked_ioctl = ioctl_tense,
+	.mmap           = mmap_tense,
 	.release        = release_tense,
 };
 
+// Undoes the tracepoint probes of tense_init, also when it fails
+static void unregister_probes(void)
+{
+	if (bio_queue_tp) {
+		tracepoint_probe_unregister(bio_queue_tp, probe_bio_queue, NULL);
+		tracepoint_synchronize_unregister();
+	}
+
+	if (migrate_tp) {
+		tracepoint_probe_unregister(migrate_tp, probe_migrate, NULL);
+		tracepoint_synchronize_unregister();
+	}
+
+	if (fork_tp && exit_tp) {
+		tracepoint_probe_unregister(fork_tp, probe_fork, NULL);
+		tracepoint_probe_unregister(exit_tp, probe_exit, NULL);
+		tracepoint_synchronize_unregister();
+	}
+}
+
 static int __init
 tense_init(void)
 {
+	int err;
+
+	err = tense_vvar_init();
+	if (err)
+		return err;
+
+	err = tense_events_init(event_buffer_kb * 1024);
+	if (err)
+		return err;
+
 	init();
-	
+
+	start_calibration();
+
+	// Without it measured I/O is scaled by the factor for any device
+	for_each_kernel_tracepoint(find_bio_queue, NULL);
+	if (bio_queue_tp)
+		tracepoint_probe_register(bio_queue_tp, probe_bio_queue, NULL);
+
+	// Without it migrations are not counted, balance works all the same
+	for_each_kernel_tracepoint(find_migrate_tp, NULL);
+	if (migrate_tp)
+		tracepoint_probe_register(migrate_tp, probe_migrate, NULL);
+
+	// Without them cgroups can't be bound
+	for_each_kernel_tracepoint(find_process_tps, NULL);
+	if (fork_tp && exit_tp) {
+		tracepoint_probe_register(fork_tp, probe_fork, NULL);
+		tracepoint_probe_register(exit_tp, probe_exit, NULL);
+	}
+
+	err = -ENOMEM;
+
 	debugfs_file = debugfs_create_file_unsafe(TENSE_NAME, 0666,
 		NULL, /* place it in root of debugfs */
 		NULL, /* private data is setup on open */
 		&tense_fops);
+	if (IS_ERR_OR_NULL(debugfs_file))
+		goto err_file;
+
+	debugfs_stats_file = debugfs_create_file(TENSE_STATS_NAME, 0666,
+		NULL, NULL, &tense_stats_fops);
+	if (IS_ERR_OR_NULL(debugfs_stats_file))
+		goto err_stats;
+
+	debugfs_events_file = debugfs_create_file(TENSE_EVENTS_NAME, 0444,
+		NULL, NULL, &tense_events_fops);
+	if (IS_ERR_OR_NULL(debugfs_events_file))
+		goto err_events;
+
+	if (fork_tp && exit_tp) {
+		debugfs_cgroups_file = debugfs_create_file(TENSE_CGROUPS_NAME,
+			0600, NULL, NULL, &tense_cgroups_fops);
+		if (IS_ERR_OR_NULL(debugfs_cgroups_file))
+			goto err_cgroups;
+	}
+
+	debugfs_replay_file = debugfs_create_file(TENSE_REPLAY_NAME, 0600,
+		NULL, NULL, &tense_replay_fops);
+	if (IS_ERR_OR_NULL(debugfs_replay_file))
+		goto err_replay;
+
 	return 0;
+
+	// The same as tense_exit, nothing can have used the files yet
+err_replay:
+	debugfs_remove(debugfs_cgroups_file);
+err_cgroups:
+	debugfs_remove(debugfs_events_file);
+err_events:
+	debugfs_remove(debugfs_stats_file);
+err_stats:
+	debugfs_remove(debugfs_file);
+err_file:
+	unregister_probes();
+	stop_calibration();
+	tense_nop();
+	tense_events_exit();
+	return err;
 }
 
 static void __exit
@@ -495,7 +3748,27 @@ tense_exit(void)
 	// Set tense to do nothing
 	tense_nop();
 
+	unregister_probes();
+
+	debugfs_remove(debugfs_cgroups_file);
+	unbind_cgroups();
+	detach_cgroup_tasks();
+	stop_adapt();
+	stop_calibration();
+
+	debugfs_remove(debugfs_replay_file);
+	debugfs_remove(debugfs_events_file);
+	debugfs_remove(debugfs_stats_file);
 	debugfs_remove(debugfs_file);
+	free_replay(xchg(&replay_next, NULL));
+
+	// Nobody records events once the events file is closed
+	tense_events_exit();
+
+	// Wait for experiments to be freed
+	rcu_barrier();
+	flush_work(&hooks_work);
+	WARN_ON(static_key_enabled(&tense_active));
 }
 
 MODULE_LICENSE("GPL");
@@ -1,68 +1,144 @@
-// #include <linux/mm.h>
-// #define VM_VTIME (VM_DONTEXPAND | VM_DONTDUMP)
-
-/* .mmap           = file_mmap, \ */
-
-// static void
-// mmap_open(struct vm_area_struct *vma)
-// {
-//         u64 vtime = 1;
-//         // printk(KERN_NOTICE "mmap vtime vma for %s\n", current->comm);
-
-//         current->vtime_vma = (void *)get_zeroed_page(GFP_KERNEL);
-
-//         // Initialize with a vtime spd of 1     
-//         memcpy(current->vtime_vma, &vtime, sizeof(u64));
-
-//         // printk(KERN_NOTICE "\tinit val is %llu\n", *(u64 *)current->vtime_vma);
-// }
-
-// static void
-// mmap_close(struct vm_area_struct *vma)
-// {
-//         free_page((unsigned long)current->vtime_vma);
-// }
-
-// static int
-// mmap_fault(struct vm_fault *vmf)
-// {
-//         struct page *vtime_page;
-//         // u64 *vma = current->vtime_vma;
-
-//         // printk(KERN_NOTICE "mmap fault handler\n");
-//         // printk(KERN_NOTICE "\tfault addr %lu\n", vmf->address);
-//         // printk(KERN_NOTICE "\tfault flags %u\n", vmf->flags);
-//         // printk(KERN_NOTICE "\tvtime_vma addr %lu\n", (unsigned long)current->vtime_vma);
-        
-//         if (!current->vtime_vma)
-//                 return VM_FAULT_SIGBUS;
-
-//         // while (*vma) {
-//         //      printk(KERN_NOTICE "\tvma value %llu\n", *vma);
-//         //      vma++;
-//         // }
-
-//         vtime_page = virt_to_page(current->vtime_vma);
-        
-//         get_page(vtime_page);
-//         vmf->page = vtime_page;
-//         return 0;
-// }
-
-
-// struct vm_operations_struct tense_vmops = {
-//         .open =         mmap_open,
-//         .close =        mmap_close,
-//         .fault =        mmap_fault,
-// };
-
-// static int
-// file_mmap(struct file *filp, struct vm_area_struct *vma)
-// {
-//         printk(KERN_NOTICE "file mmap %s\n", current->comm);
-
-//         vma->vm_ops = &tense_vmops;
-//         vma->vm_flags |= VM_VTIME;
-//         mmap_open(vma);
-//         return 0;
-// }
+#include <linux/clocksource.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <asm/tsc.h>
+
+#include "tense.h"
+
+#define VM_VTIME (VM_DONTEXPAND | VM_DONTDUMP)
+
+/*
+ * Conversion from TSC cycles to ns, the same for every page. A mult of 0 means
+ * the TSC cannot be used from user space.
+ */
+static u32 vvar_mult, vvar_shift;
+
+int tense_vvar_init(void)
+{
+	BUILD_BUG_ON(sizeof(struct tense_vvar) > PAGE_SIZE);
+
+	/*
+	 * Without an invariant TSC user space cannot convert cycles to ns on
+	 * its own. Pages are then left at version 0 and libtense falls back to
+	 * read().
+	 */
+	if (!boot_cpu_has(X86_FEATURE_CONSTANT_TSC) || !tsc_khz)
+		return 0;
+
+	/* Valid for deltas of up to 600 s, tsc_khz is in kHz */
+	clocks_calc_mult_shift(&vvar_mult, &vvar_shift, tsc_khz, NSEC_PER_MSEC,
+		600 * MSEC_PER_SEC);
+
+	return 0;
+}
+
+/*
+ * Each experiment has its own pages which are mapped read-only into every
+ * process of the experiment which asks for them. Only update_curr, switch_in
+ * and set_current_tdf write to them, see tense_vvar_publish. They hold a
+ * timeline for every possible CPU, so a task reads its time without a system
+ * call wherever it runs.
+ */
+struct tense_vvar *tense_vvar_alloc(void)
+{
+	struct tense_vvar *vvar;
+	size_t size = sizeof(*vvar)
+		+ nr_cpu_ids * sizeof(struct tense_vvar_timeline);
+
+	// Not physically contiguous, see tense_vvar_mmap
+	vvar = vmalloc_user(PAGE_ALIGN(size));
+	if (!vvar)
+		return NULL;
+
+	vvar->nr_cpus = nr_cpu_ids;
+	vvar->pages = PAGE_ALIGN(size) >> PAGE_SHIFT;
+	if (!vvar_mult)
+		return vvar;
+
+	vvar->mult = vvar_mult;
+	vvar->shift = vvar_shift;
+	smp_wmb();
+	vvar->version = TENSE_VVAR_VERSION;
+
+	return vvar;
+}
+
+void tense_vvar_free(struct tense_vvar *vvar)
+{
+	vfree(vvar);
+}
+
+static int
+mmap_fault(struct vm_fault *vmf)
+{
+	/* The whole page is inserted at mmap time */
+	return VM_FAULT_SIGBUS;
+}
+
+static const struct vm_operations_struct tense_vmops = {
+	.fault		= mmap_fault,
+};
+
+/*
+ * The mapping holds a reference to the file, so the task which opened it and
+ * with it the experiment and the page stay around until it is unmapped.
+ */
+int tense_vvar_mmap(struct tense_vvar *vvar, struct vm_area_struct *vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	// Only the first page, to read the number of pages, or all of them
+	if (vma->vm_pgoff || (size != PAGE_SIZE
+		&& size != (unsigned long) vvar->pages << PAGE_SHIFT))
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_VTIME;
+	vma->vm_ops = &tense_vmops;
+
+	return remap_vmalloc_range(vma, vvar, 0);
+}
+
+/*
+ * The warp stack of @task is allocated the first time it is mapped. It is
+ * shared writable with the process, so the hooks must not trust anything they
+ * read from it, see set_task_warp.
+ */
+int tense_warp_mmap(struct tense_task *task, struct vm_area_struct *vma)
+{
+	struct tense_warp *warp = task->warp;
+
+	BUILD_BUG_ON(sizeof(struct tense_warp) > PAGE_SIZE);
+
+	if (vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	// A private copy would never reach the module
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	if (!warp) {
+		warp = (struct tense_warp *)get_zeroed_page(GFP_KERNEL);
+		if (!warp)
+			return -ENOMEM;
+
+		warp->version = TENSE_WARP_VERSION;
+		WRITE_ONCE(task->warp, warp);
+	}
+
+	vma->vm_flags |= VM_VTIME;
+	vma->vm_ops = &tense_vmops;
+
+	return remap_pfn_range(vma, vma->vm_start,
+		virt_to_phys(warp) >> PAGE_SHIFT, PAGE_SIZE,
+		vma->vm_page_prot);
+}
+
+void tense_warp_free(struct tense_task *task)
+{
+	free_page((unsigned long)task->warp);
+}
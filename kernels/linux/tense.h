@@ -1,15 +1,343 @@
 #ifndef _DRIVERS_TENSE_H
 #define _DRIVERS_TENSE_H
 
+#include <linux/cpumask.h>
+#include <linux/fs.h>
+#include <linux/jump_label.h>
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/mm_types.h>
+#include <linux/percpu.h>
+#include <linux/rbtree.h>
 #include <linux/sched/tense.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <asm/msr.h>
 
-struct tense_module_operations {
-        struct tense_operations tense_ops;
-        void (*init_module) (void);
-        void (*add_current_task) (void);
-        void (*remove_current_task)(void);
+#include "tense_core.h"
+#include "tense_uapi.h"
+
+/* SECTION Experiments */
+
+/*
+ * struct tense_timeline - virtual time as seen by one CPU
+ *
+ * @time:	virtual time in ns
+ * @updated:	local_clock() at the last update; a CPU which has not updated
+ *		its timeline for a while no longer runs tense tasks
+ * @exec:	real time tense tasks have run on the CPU in total
+ * @vexec:	@exec as virtual time, so the speed of time is their ratio
+ */
+struct tense_timeline {
+	u64	time;
+	u64	updated;
+	u64	exec;
+	u64	vexec;
+};
+
+/*
+ * Sleeping tasks on each CPU ordered by wakeup_time. The lock is taken from
+ * the tick and from hrtimer callbacks so interrupts must be disabled. The timer
+ * fires when the first of them is due, see program_sleepers.
+ */
+struct tense_sleepers {
+	raw_spinlock_t		lock;
+	struct rb_root_cached	root;
+	struct hrtimer		timer;
+	struct tense_experiment	*experiment;
+	int			cpu;
+};
+
+/*
+ * Tasks of an experiment, hashed by address so that joining and leaving from
+ * many threads at once doesn't contend on a single lock.
+ */
+#define TENSE_TASKS_BITS 6
+
+struct tense_tasks_bucket {
+	spinlock_t		lock;
+	struct list_head	list;
+};
+
+/*
+ * Scaling of measured I/O time on one device, see set_io_factor. Entries with
+ * a @mult of 0 are free.
+ */
+#define TENSE_IO_FACTORS 8
+
+struct tense_io_factor {
+	dev_t	dev;
+	u32	shift;
+	u64	mult;
+};
+
+/*
+ * Virtual cost of a type of page fault, drawn uniformly from @ns - @spread to
+ * @ns + @spread, see fault_model.
+ */
+#define TENSE_FAULT_MINOR	0
+#define TENSE_FAULT_MAJOR	1
+#define TENSE_FAULT_TYPES	2
+
+struct tense_fault_cost {
+	u64	ns;
+	u64	spread;
+};
+
+/*
+ * struct tense_replay - a recorded schedule replayed by an experiment
+ *
+ * @entries:	the schedule, see struct tense_replay_entry
+ * @nr:		number of @entries
+ * @cursor:	next entry to switch in, @nr once the replay is over
+ * @waits:	switches of tasks whose turn it was not, which had to wait
+ * @diverged:	entries skipped because their task did not show up in time
+ * @skew_ns:	total difference in virtual time between the switches and
+ *		the entries they matched
+ */
+struct tense_replay {
+	struct tense_replay_entry	*entries;
+	u32				nr;
+	atomic_t			cursor;
+	atomic64_t			waits;
+	atomic64_t			diverged;
+	atomic64_t			skew_ns;
 };
 
-extern tense_module_operations * basic;
+/*
+ * struct tense_experiment - a set of tense tasks sharing virtual time
+ *
+ * @id:		number of the experiment, for logs and statistics
+ * @ref:	one reference for each task and one for each lookup in progress
+ * @timelines:	per-cpu timeline
+ * @tense_mask:	cpus that have runnable tense tasks of this experiment on
+ * @min_time:	minimum of the timelines of all CPUs in @tense_mask; it never
+ *		goes back, so a CPU which starts running tense tasks can join
+ *		at this point without moving anyone back in time
+ * @sleepers:	per-cpu sleepers of this experiment
+ * @sleepers_mask:	cpus that have sleepers of this experiment queued
+ * @tasks:	all tasks in the experiment, which may be walked under
+ *		rcu_read_lock as well
+ * @nr_tasks:	number of tasks in @tasks
+ * @next_index:	index of the next task to join, see struct tense_task
+ * @replay:	schedule the tasks are made to follow, NULL if none
+ * @sync_type:	TENSE_SYNC_*, see the sync_type module parameter
+ * @sync_bound:	see the sync_bound module parameter
+ * @sync_wait:	throttled tasks wait here for @min_time to catch up
+ * @throttles:	number of times a task was throttled
+ * @throttled_ns:	total real time tasks spent throttled
+ * @dilation:	TENSE_DILATION_*, see the dilation module parameter
+ * @deterministic:	see the deterministic module parameter
+ * @det_waits:	number of times a task waited for its turn in deterministic
+ *		mode
+ * @det_wait_ns:	total real time tasks spent waiting for their turn
+ * @fast_forward:	real time the experiment waits with no runnable task
+ *		before it jumps to the next wakeup, 0 if it never does
+ * @forward_timer:	armed whenever a task goes to sleep, see fast_forward
+ * @forward_seq:	written by fast_forward from its idle check to its jump,
+ *		and read by this_timeline so that no task joins in between
+ * @forwards:	number of such jumps
+ * @forward_ns:	total virtual time skipped by them
+ * @balance:	see the balance module parameter
+ * @balance_bound:	see the balance_bound module parameter
+ * @migrations:	number of times a task moved to another CPU
+ * @migration_jump_ns:	total virtual time tasks skipped by joining the
+ *		timeline of the CPU they moved to
+ * @migrations_refused:	load balancer migrations refused by @balance
+ * @fault_model:	see the fault_model module parameter
+ * @fault_cost:	cost of each type of fault, see TENSE_FAULT_*
+ * @faults:	number of faults of each type whose cost was replaced
+ * @fault_real_ns:	real runtime those faults took out of virtual time
+ * @fault_virtual_ns:	virtual time they were charged instead
+ * @adapt:	slowdown in permille which the controller applies on top of the
+ *		factor of every task, 1000 while it is off
+ * @adapt_ms:	period of the controller, 0 if it is off
+ * @adapt_lag:	see the adapt_lag module parameter
+ * @adapt_work:	runs the controller, holding a reference to the experiment
+ * @adapt_exec:	sum of the @exec of all timelines at the last period
+ * @adapt_vexec:	the same for @vexec
+ * @speed:	moving average of virtual over real time in permille
+ * @lag:	lead of the furthest timeline over @min_time at the last period
+ * @pressure:	runnable tasks per online CPU in permille at the last period
+ * @vvar:	pages shared with user space, see struct tense_vvar
+ * @io_lock:	protects @io_factors
+ * @io_factors:	per-device scaling of measured I/O time
+ * @list:	list_head for the list of all experiments
+ * @rcu:	experiments are freed after a grace period so that they can be
+ *		looked up from other tasks without locks
+ */
+struct tense_experiment {
+	int				id;
+	struct kref			ref;
+
+	struct tense_timeline __percpu	*timelines;
+	cpumask_var_t			tense_mask;
+	u64				min_time;
+
+	struct tense_sleepers __percpu	*sleepers;
+	cpumask_var_t			sleepers_mask;
+
+	struct tense_tasks_bucket	tasks[1 << TENSE_TASKS_BITS];
+	atomic_t			nr_tasks;
+	atomic_t			next_index;
+
+	struct tense_replay		*replay;
+
+	u8				sync_type;
+	unsigned long			sync_bound;
+	wait_queue_head_t		sync_wait;
+	atomic64_t			throttles;
+	atomic64_t			throttled_ns;
+	u8				dilation;
+
+	bool				deterministic;
+	atomic64_t			det_waits;
+	atomic64_t			det_wait_ns;
+
+	ktime_t				fast_forward;
+	struct hrtimer			forward_timer;
+	seqcount_t			forward_seq;
+	atomic64_t			forwards;
+	atomic64_t			forward_ns;
+
+	bool				balance;
+	unsigned long			balance_bound;
+	atomic64_t			migrations;
+	atomic64_t			migration_jump_ns;
+	atomic64_t			migrations_refused;
+
+	u8				fault_model;
+	struct tense_fault_cost		fault_cost[TENSE_FAULT_TYPES];
+	atomic64_t			faults[TENSE_FAULT_TYPES];
+	atomic64_t			fault_real_ns;
+	atomic64_t			fault_virtual_ns;
+
+	u32				adapt;
+	unsigned long			adapt_ms;
+	unsigned long			adapt_lag;
+	struct delayed_work		adapt_work;
+	u64				adapt_exec;
+	u64				adapt_vexec;
+	u32				speed;
+	u64				lag;
+	u32				pressure;
+
+	struct tense_vvar		*vvar;
+
+	spinlock_t			io_lock;
+	struct tense_io_factor		io_factors[TENSE_IO_FACTORS];
+
+	struct list_head		list;
+	struct rcu_head			rcu;
+};
+
+#define TENSE_CGROUPS		16
+#define TENSE_CGROUP_PATH	128
+
+/*
+ * struct tense_cgroup - a cgroup whose tasks join the cgroup experiment
+ *
+ * @cgrp:	the cgroup on the default (v2) hierarchy
+ * @ref:	one reference for the binding and one for each attached task
+ * @tdf:	time dilation factor of the tasks, faster in the high half
+ * @path:	path of @cgrp as it was bound
+ * @rcu:	freed after a grace period, tasks are attached from fork
+ */
+struct tense_cgroup {
+	struct cgroup			*cgrp;
+	struct kref			ref;
+	u64				tdf;
+	char				path[TENSE_CGROUP_PATH];
+	struct rcu_head			rcu;
+};
+
+#define TENSE_DILATION_VRUNTIME	0
+#define TENSE_DILATION_SLICE	1
+
+// At most 16 MiB of schedule
+#define TENSE_REPLAY_MAX	(1 << 20)
+
+/* Events kept by the record module parameter, enough to replay a run */
+#define TENSE_RECORD_EVENTS (BIT(TENSE_EVENT_SLEEP) | BIT(TENSE_EVENT_WAKEUP) \
+	| BIT(TENSE_EVENT_TDF) | BIT(TENSE_EVENT_JOIN) | BIT(TENSE_EVENT_SWITCH))
+
+#define cpu_tense(exp, cpu) cpumask_test_cpu((cpu), (exp)->tense_mask)
+
+/* SECTION Shared virtual time page (mmap.c) */
+
+int tense_vvar_init(void);
+
+struct tense_vvar *tense_vvar_alloc(void);
+
+void tense_vvar_free(struct tense_vvar *vvar);
+
+int tense_vvar_mmap(struct tense_vvar *vvar, struct vm_area_struct *vma);
+
+int tense_warp_mmap(struct tense_task *task, struct vm_area_struct *vma);
+
+void tense_warp_free(struct tense_task *task);
+
+/*
+ * Publish a new value of the timeline of @cpu to user space. Only @cpu writes
+ * to its own timeline. Interrupts should be disabled so that readers never
+ * spin on an odd sequence for long.
+ */
+static inline void
+tense_vvar_publish(struct tense_vvar *vvar, int cpu, u64 time,
+	struct tense_task *task)
+{
+	struct tense_vvar_timeline *tl = &vvar->timelines[cpu];
+
+
+	WRITE_ONCE(tl->seq, tl->seq + 1);
+	smp_wmb();
+
+	tl->id = task->index + 1;
+	tl->time = time;
+	tl->cycles = rdtsc_ordered();
+	tl->faster = task->faster;
+	tl->slower = task->slower;
+	tl->scale_mult = task->scale_mult;
+	tl->scale_shift = task->scale_shift;
+
+	smp_wmb();
+	WRITE_ONCE(tl->seq, tl->seq + 1);
+}
+
+/* SECTION Binary event buffer (trace.c) */
+
+DECLARE_STATIC_KEY_FALSE(tense_events_enabled);
+
+extern const struct file_operations tense_events_fops;
+
+int tense_events_init(unsigned long size);
+
+void tense_events_exit(void);
+
+void __tense_event(u16 type, pid_t pid, u64 time, u64 arg);
+
+u64 tense_events_dropped(void);
+
+/*
+ * Record an event of @type, see struct tense_event. This is a patched out
+ * branch while the events file is closed.
+ */
+static inline void
+tense_event(u16 type, struct tense_task *task, u64 time, u64 arg)
+{
+	if (static_branch_unlikely(&tense_events_enabled))
+		__tense_event(type, task->task_struct->pid, time, arg);
+}
+
+/*
+ * The same for an event about a whole experiment, recorded with a pid of 0.
+ */
+static inline void tense_experiment_event(u16 type, u64 time, u64 arg)
+{
+	if (static_branch_unlikely(&tense_events_enabled))
+		__tense_event(type, 0, time, arg);
+}
 
-#endif
\ No newline at end of file
+#endif
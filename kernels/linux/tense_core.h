@@ -0,0 +1,166 @@
+#ifndef _TENSE_CORE_H
+#define _TENSE_CORE_H
+
+/*
+ * The arithmetic of virtual time, apart from the locking and per-cpu data
+ * around it: how timelines advance and join, how the minimum of an experiment
+ * moves, how factors compose and when sleepers are due. The module runs it in
+ * the scheduler hooks and the simulator in libtense/sim replays workloads
+ * through the very same functions.
+ *
+ * Like tense_scale.h, only the fixed-size types of <linux/types.h> and
+ * compiler builtins are used.
+ */
+
+#include <linux/types.h>
+#include "tense_scale.h"
+
+#define TENSE_TIME_MAX	((__u64) -1)
+
+#define TENSE_SYNC_NONE		0
+#define TENSE_SYNC_BARRIER	1
+#define TENSE_SYNC_LAG		2
+#define TENSE_SYNC_LOOKAHEAD	3
+
+static inline __u64 tense_gcd64(__u64 a, __u64 b)
+{
+	__u64 t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/*
+ * Where a timeline at @time stands once a task at @vtime runs on it. A
+ * timeline which was not @active is stale, whether behind or ahead, and
+ * restarts at @min_time of the experiment, so that a task migrating to it
+ * doesn't jump to where it was left. No timeline falls behind the task, so
+ * that virtual time never goes back for it after a migration.
+ */
+static inline __u64
+tense_timeline_join(__u64 time, int active, __u64 min_time, __u64 vtime)
+{
+	if (!active)
+		time = min_time;
+
+	return time < vtime ? vtime : time;
+}
+
+/*
+ * Virtual time which decides when a task sleeping on a CPU wakes up. A CPU
+ * which is not @active has a stale @time, so its sleepers follow @min_time.
+ */
+static inline __u64 tense_cpu_time(int active, __u64 time, __u64 min_time)
+{
+	return active ? time : min_time;
+}
+
+/*
+ * The new minimum of an experiment given @min of its active timelines,
+ * TENSE_TIME_MAX if there are none. It never goes back.
+ */
+static inline __u64 tense_min_advance(__u64 min_time, __u64 min)
+{
+	return min != TENSE_TIME_MAX && min > min_time ? min : min_time;
+}
+
+/*
+ * Compose a base factor, the top of a warp stack and a slowdown in permille
+ * into @faster / @slower, reduced to lowest terms. The products take up to 74
+ * bits, so each factor is first reduced against the others and the products
+ * are taken in 128 bits. A factor which still doesn't fit in 32 bits loses
+ * precision rather than failing.
+ */
+static inline void
+tense_compose_tdf(__u32 *faster, __u32 *slower, __u32 base_faster,
+	__u32 base_slower, __u32 top_faster, __u32 top_slower, __u32 adapt)
+{
+	__u64 n[3] = { base_faster, top_faster, 1000 };
+	__u64 d[3] = { base_slower, top_slower, adapt };
+	unsigned __int128 f, s, m;
+	__u64 g, high;
+	int i, j, excess;
+
+	/* Pairwise coprime factors leave the products in lowest terms */
+	for (i = 0; i < 3; ++i) {
+		for (j = 0; j < 3; ++j) {
+			g = tense_gcd64(n[i], d[j]);
+			if (g > 1) {
+				n[i] /= g;
+				d[j] /= g;
+			}
+		}
+	}
+
+	f = (unsigned __int128) n[0] * n[1] * n[2];
+	s = (unsigned __int128) d[0] * d[1] * d[2];
+
+	m = f | s;
+	high = m >> 64;
+	excess = (high ? 128 - __builtin_clzll(high)
+		: m ? 64 - __builtin_clzll((__u64) m) : 0) - 32;
+	if (excess > 0) {
+		f >>= excess;
+		s >>= excess;
+	}
+
+	*faster = f ? (__u32) f : 1;
+	*slower = s ? (__u32) s : 1;
+}
+
+/*
+ * Real time until a sleeper which wakes up at @wakeup_time is due when its CPU
+ * is at @now and runs at the factor of @inv_mult and @inv_shift from
+ * tense_scale_calc(slower, faster), assuming it keeps running until then.
+ */
+static inline __u64
+tense_wakeup_delay(__u64 wakeup_time, __u64 now, __u64 inv_mult,
+	__u32 inv_shift)
+{
+	if (wakeup_time <= now)
+		return 0;
+
+	return tense_scale_apply(wakeup_time - now, inv_mult, inv_shift);
+}
+
+/*
+ * Virtual time up to which a task may go before it has to wait for the rest
+ * of the experiment under @sync_type. @bound is sync_bound and @lookahead the
+ * earliest time at which another task runs or wakes up, TENSE_TIME_MAX if
+ * there is none; only TENSE_SYNC_LOOKAHEAD uses it.
+ *
+ * The barrier cuts virtual time into windows of @bound and lets nobody into
+ * the next window before all are through the current one. Lag follows
+ * @min_time at a distance of @bound. Lookahead is the conservative scheme of
+ * parallel discrete event simulation: another task can only affect this one
+ * from its own time on, so it is enough to stay within @bound of the slowest
+ * other CPU and of the next wakeup.
+ */
+static inline __u64
+tense_sync_horizon(int sync_type, __u64 min_time, __u64 bound, __u64 lookahead)
+{
+	switch (sync_type) {
+	case TENSE_SYNC_BARRIER:
+		if (!bound)
+			return min_time;
+		return min_time - min_time % bound + bound;
+
+	case TENSE_SYNC_LAG:
+		return min_time + bound;
+
+	case TENSE_SYNC_LOOKAHEAD:
+		if (lookahead == TENSE_TIME_MAX)
+			return TENSE_TIME_MAX;
+		return (lookahead > min_time ? lookahead : min_time) + bound;
+
+	default:
+		return TENSE_TIME_MAX;
+	}
+}
+
+#endif /* _TENSE_CORE_H */
@@ -0,0 +1,37 @@
+#ifndef _TENSE_NOP_H
+#define _TENSE_NOP_H
+
+/*
+ * The busy loop behind nops_per_ms. Its speed follows the CPU clock, so the
+ * module measures how many iterations take 1 ms at load time and again when
+ * the frequency changes, and libtense spins for a given real time with it.
+ *
+ * Used by the module and by libtense, which must run the very same
+ * instructions for the calibration to carry over. It is written in assembly
+ * so that neither the compiler nor its flags change the loop. x86-64 only,
+ * like the rest of tense.
+ */
+
+#include <linux/types.h>
+
+static inline void tense_nops(__u64 n)
+{
+	if (!n)
+		return;
+
+	asm volatile("1:\n\t"
+		     "dec %0\n\t"
+		     "jnz 1b"
+		     : "+r" (n) : : "cc");
+}
+
+/*
+ * Iterations of tense_nops which take @ns at @nops_per_ms, without overflow
+ * for any @ns below 2^64 / 1000.
+ */
+static inline __u64 tense_nops_for_ns(__u64 ns, __u64 nops_per_ms)
+{
+	return ns / 1000000 * nops_per_ms + ns % 1000000 * nops_per_ms / 1000000;
+}
+
+#endif /* _TENSE_NOP_H */
@@ -0,0 +1,81 @@
+#ifndef _TENSE_SCALE_H
+#define _TENSE_SCALE_H
+
+/*
+ * Time dilation without division. A factor num / den is turned into a
+ * multiplier and a shift once, when it is set, so that scaling a duration only
+ * takes a multiplication and a shift, like clocksource cycles to ns.
+ *
+ * Used by the module and by libtense, so only the fixed-size types of
+ * <linux/types.h> and compiler builtins are used. The 128-bit products need a
+ * 64-bit target, which tense requires anyway for rdtsc.
+ */
+
+#include <linux/types.h>
+
+static inline __u32 tense_gcd(__u32 a, __u32 b)
+{
+	__u32 t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static inline unsigned int tense_ilog2(__u32 x)
+{
+	return 31 - __builtin_clz(x);
+}
+
+/*
+ * Compute @mult and @shift such that
+ *
+ *   (x * mult) >> shift == x * num / den
+ *
+ * for every x below 2^61 / num, with num / den reduced by their GCD. Beyond
+ * that the result may be 1 ns too large. @mult stays below 2^63, so the
+ * product fits in 128 bits for any 64-bit x. Neither @num nor @den may be 0.
+ */
+static inline void
+tense_scale_calc(__u64 *mult, __u32 *shift, __u32 num, __u32 den)
+{
+	unsigned __int128 n, q = 0;
+	__u64 cur, r = 0;
+	__u32 g = tense_gcd(num, den);
+	int i;
+
+	num /= g;
+	den /= g;
+
+	*shift = 62 + tense_ilog2(den) - tense_ilog2(num);
+
+	/*
+	 * Round (num << shift) / den up. Long division in 32-bit limbs keeps
+	 * every step a 64 by 32 bit division which the kernel can do.
+	 */
+	n = (unsigned __int128) num << *shift;
+	for (i = 3; i >= 0; i--) {
+		cur = (r << 32) | (__u32) (n >> (32 * i));
+		q = (q << 32) | (cur / den);
+		r = cur % den;
+	}
+
+	*mult = (__u64) q + (r != 0);
+}
+
+/*
+ * Scale @x by the factor given by @mult and @shift from tense_scale_calc. A
+ * result which does not fit in 64 bits saturates instead of wrapping.
+ */
+static inline __u64 tense_scale_apply(__u64 x, __u64 mult, __u32 shift)
+{
+	unsigned __int128 r = ((unsigned __int128) x * mult) >> shift;
+
+	return r > (__u64) -1 ? (__u64) -1 : (__u64) r;
+}
+
+#endif /* _TENSE_SCALE_H */
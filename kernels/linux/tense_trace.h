@@ -0,0 +1,190 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tense
+
+#if !defined(_TENSE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TENSE_TRACE_H
+
+#include <linux/sched.h>
+#include <linux/tracepoint.h>
+
+#include "tense.h"
+
+/*
+ * Every event records the task it is about, its position on the virtual
+ * timeline and one argument whose meaning depends on the event. The same
+ * triple goes to the binary event buffer, see struct tense_event.
+ */
+DECLARE_EVENT_CLASS(tense_task_event,
+
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+
+	TP_ARGS(task, time, arg),
+
+	TP_STRUCT__entry(
+		__field(pid_t,	pid)
+		__field(int,	experiment)
+		__field(u64,	time)
+		__field(u64,	arg)
+	),
+
+	TP_fast_assign(
+		__entry->pid = task->task_struct->pid;
+		__entry->experiment = task->experiment->id;
+		__entry->time = time;
+		__entry->arg = arg;
+	),
+
+	TP_printk("pid=%d experiment=%d time=%llu arg=%llu", __entry->pid,
+		__entry->experiment, __entry->time, __entry->arg)
+);
+
+/* update_curr moved the timeline by @arg ns of virtual time */
+DEFINE_EVENT_PRINT(tense_task_event, tense_update,
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+	TP_ARGS(task, time, arg),
+	TP_printk("pid=%d experiment=%d time=%llu delta=%llu", __entry->pid,
+		__entry->experiment, __entry->time, __entry->arg)
+);
+
+/* A task joined the sleepers, @arg is its wakeup time */
+DEFINE_EVENT_PRINT(tense_task_event, tense_sleep,
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+	TP_ARGS(task, time, arg),
+	TP_printk("pid=%d experiment=%d time=%llu wakeup=%llu", __entry->pid,
+		__entry->experiment, __entry->time, __entry->arg)
+);
+
+/* A sleeper was woken up, @arg is the wakeup time it asked for */
+DEFINE_EVENT_PRINT(tense_task_event, tense_wakeup,
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+	TP_ARGS(task, time, arg),
+	TP_printk("pid=%d experiment=%d time=%llu expected=%llu", __entry->pid,
+		__entry->experiment, __entry->time, __entry->arg)
+);
+
+/* The TDF changed, @arg is faster in the high and slower in the low half */
+DEFINE_EVENT_PRINT(tense_task_event, tense_tdf,
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+	TP_ARGS(task, time, arg),
+	TP_printk("pid=%d experiment=%d time=%llu faster=%u slower=%u",
+		__entry->pid, __entry->experiment, __entry->time,
+		(u32) (__entry->arg >> 32), (u32) __entry->arg)
+);
+
+/* A task moved itself forward on the timeline by @arg ns */
+DEFINE_EVENT_PRINT(tense_task_event, tense_move,
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+	TP_ARGS(task, time, arg),
+	TP_printk("pid=%d experiment=%d time=%llu offset=%llu", __entry->pid,
+		__entry->experiment, __entry->time, __entry->arg)
+);
+
+/* A task ran too far ahead and waits for the others up to @arg, see sync_type */
+DEFINE_EVENT_PRINT(tense_task_event, tense_throttle,
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+	TP_ARGS(task, time, arg),
+	TP_printk("pid=%d experiment=%d time=%llu horizon=%llu", __entry->pid,
+		__entry->experiment, __entry->time, __entry->arg)
+);
+
+/* A task joined its experiment as the @arg-th, see replay */
+DEFINE_EVENT_PRINT(tense_task_event, tense_join,
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+	TP_ARGS(task, time, arg),
+	TP_printk("pid=%d experiment=%d time=%llu index=%llu", __entry->pid,
+		__entry->experiment, __entry->time, __entry->arg)
+);
+
+/* The task with index @arg left its experiment */
+DEFINE_EVENT_PRINT(tense_task_event, tense_leave,
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+	TP_ARGS(task, time, arg),
+	TP_printk("pid=%d experiment=%d time=%llu index=%llu", __entry->pid,
+		__entry->experiment, __entry->time, __entry->arg)
+);
+
+/* The task with index @arg was switched in */
+DEFINE_EVENT_PRINT(tense_task_event, tense_switch,
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+	TP_ARGS(task, time, arg),
+	TP_printk("pid=%d experiment=%d time=%llu index=%llu", __entry->pid,
+		__entry->experiment, __entry->time, __entry->arg)
+);
+
+/* A task moved to another CPU and skips @arg ns joining its timeline */
+DEFINE_EVENT_PRINT(tense_task_event, tense_migrate,
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+	TP_ARGS(task, time, arg),
+	TP_printk("pid=%d experiment=%d time=%llu jump=%llu", __entry->pid,
+		__entry->experiment, __entry->time, __entry->arg)
+);
+
+/* A page fault was charged a modelled cost, see fault_model */
+DEFINE_EVENT_PRINT(tense_task_event, tense_fault,
+	TP_PROTO(struct tense_task *task, u64 time, u64 arg),
+	TP_ARGS(task, time, arg),
+	TP_printk("pid=%d experiment=%d time=%llu major=%d cost=%llu",
+		__entry->pid, __entry->experiment, __entry->time,
+		(int) (__entry->arg >> 63), __entry->arg & ~BIT_ULL(63))
+);
+
+/* The controller changed the slowdown of an experiment, see adapt_ms */
+TRACE_EVENT(tense_adapt,
+
+	TP_PROTO(struct tense_experiment *exp),
+
+	TP_ARGS(exp),
+
+	TP_STRUCT__entry(
+		__field(int,	experiment)
+		__field(u64,	time)
+		__field(u32,	adapt)
+		__field(u32,	speed)
+		__field(u64,	lag)
+		__field(u32,	pressure)
+	),
+
+	TP_fast_assign(
+		__entry->experiment = exp->id;
+		__entry->time = exp->min_time;
+		__entry->adapt = exp->adapt;
+		__entry->speed = exp->speed;
+		__entry->lag = exp->lag;
+		__entry->pressure = exp->pressure;
+	),
+
+	TP_printk("experiment=%d time=%llu adapt=%u speed=%u lag=%llu pressure=%u",
+		__entry->experiment, __entry->time, __entry->adapt,
+		__entry->speed, __entry->lag, __entry->pressure)
+);
+
+/* An idle experiment jumped @skipped ns ahead to its next wakeup */
+TRACE_EVENT(tense_forward,
+
+	TP_PROTO(struct tense_experiment *exp, u64 skipped),
+
+	TP_ARGS(exp, skipped),
+
+	TP_STRUCT__entry(
+		__field(int,	experiment)
+		__field(u64,	time)
+		__field(u64,	skipped)
+	),
+
+	TP_fast_assign(
+		__entry->experiment = exp->id;
+		__entry->time = exp->min_time;
+		__entry->skipped = skipped;
+	),
+
+	TP_printk("experiment=%d time=%llu skipped=%llu", __entry->experiment,
+		__entry->time, __entry->skipped)
+);
+
+#endif /* _TENSE_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tense_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,269 @@
+#ifndef _UAPI_TENSE_H
+#define _UAPI_TENSE_H
+
+/*
+ * Definitions shared between the tense kernel module and libtense. Only
+ * fixed-size types are used so that the same header can be included from
+ * both sides of the boundary.
+ */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* SECTION Shared virtual time page */
+
+#define TENSE_VVAR_VERSION 5
+
+/*
+ * struct tense_vvar_timeline - snapshot of the virtual timeline of one CPU
+ *
+ * @seq:	odd while the module is writing, changes on every update
+ * @id:		id of the tense task which runs or last ran on the CPU, see
+ *		TENSE_IOC_ID
+ * @time:	virtual time in ns at the last update
+ * @cycles:	TSC value at the last update
+ * @faster:	time dilation factor of the task given by @id
+ * @slower:	see @faster
+ * @scale_mult:	the same factor as a multiplier, ns * slower / faster equals
+ *		(ns * @scale_mult) >> @scale_shift, see tense_scale.h
+ * @scale_shift:	see @scale_mult
+ */
+struct tense_vvar_timeline {
+	__u32 seq;
+	__u32 id;
+	__u64 time;
+	__u64 cycles;
+	__u32 faster;
+	__u32 slower;
+	__u64 scale_mult;
+	__u32 scale_shift;
+} __attribute__((aligned(64)));
+
+/*
+ * struct tense_vvar - layout of the read-only pages mapped from the tense file
+ *
+ * @version:	TENSE_VVAR_VERSION, zero means the pages cannot be used
+ * @mult:	cycles to ns multiplier, ns = (cycles * mult) >> shift
+ * @shift:	see @mult
+ * @nr_cpus:	number of entries in @timelines, one for every possible CPU
+ * @pages:	number of pages to map, the header and one timeline per cache
+ *		line take more than one page on machines with over 63 CPUs
+ * @timelines:	the timeline of each CPU, indexed by CPU number
+ *
+ * The first page is enough to read @pages, after which the whole of them can
+ * be mapped.
+ *
+ * A reader running on a CPU whose timeline has its own id computes the
+ * current virtual time as
+ *
+ *   time + scale((rdtsc() - cycles) * mult >> shift)
+ *
+ * where scale applies the time dilation factor of the timeline, the same way
+ * the module does on its next update_curr. This is the same scheme as the vDSO
+ * uses for CLOCK_MONOTONIC. The module publishes a new snapshot whenever a
+ * tense task is switched in, so the extrapolation never covers time in which
+ * the reader was not running. Other readers have to ask the module.
+ */
+struct tense_vvar {
+	__u32 version;
+	__u32 mult;
+	__u32 shift;
+	__u32 nr_cpus;
+	__u32 pages;
+	struct tense_vvar_timeline timelines[];
+};
+
+/* SECTION Warp stack page */
+
+#define TENSE_WARP_VERSION	1
+
+/* Page offset at which the tense file maps the warp stack of the caller */
+#define TENSE_WARP_PGOFF	1
+
+#define TENSE_WARP_DEPTH	500
+
+/*
+ * struct tense_warp - layout of the writable page mapped from the tense file
+ *
+ * @version:	TENSE_WARP_VERSION, set by the module
+ * @seq:	incremented by the process after every push and pop
+ * @depth:	number of valid entries in @stack
+ * @reserved:	ignored
+ * @stack:	the factor of each nesting level, already composed with all the
+ *		levels below it
+ *
+ * Each thread gets its own page. Pushing writes the new entry, then @depth,
+ * then @seq; popping writes @depth, then @seq. The module applies the top of
+ * the stack, composed with the factor set through the file, in the scheduler
+ * hooks once it sees a new @seq. A change thus takes effect at the next tick
+ * or context switch, and the time since the previous one is charged at the
+ * factor in effect at that point. Code warped for much less than a tick is
+ * accounted for correctly on average, the way a sampling profiler attributes
+ * time, rather than exactly.
+ */
+struct tense_warp {
+	__u32 version;
+	__u32 seq;
+	__u32 depth;
+	__u32 reserved;
+	struct {
+		__u32 faster;
+		__u32 slower;
+	} stack[TENSE_WARP_DEPTH];
+};
+
+/* SECTION Event buffer */
+
+#define TENSE_EVENT_UPDATE	1
+#define TENSE_EVENT_SLEEP	2
+#define TENSE_EVENT_WAKEUP	3
+#define TENSE_EVENT_TDF		4
+#define TENSE_EVENT_MOVE	5
+#define TENSE_EVENT_ADAPT	6
+#define TENSE_EVENT_THROTTLE	7
+#define TENSE_EVENT_JOIN	8
+#define TENSE_EVENT_SWITCH	9
+#define TENSE_EVENT_FORWARD	10
+#define TENSE_EVENT_MIGRATE	11
+#define TENSE_EVENT_FAULT	12
+#define TENSE_EVENT_LEAVE	13
+
+/*
+ * struct tense_event - binary record read from the tense_events file
+ *
+ * @clock:	local_clock() of @cpu in ns when the event happened
+ * @time:	virtual time of the task at the event
+ * @arg:	depends on @type, the same as the tense_* tracepoint of the type;
+ *		for TENSE_EVENT_ADAPT the experiment id in the high and the new
+ *		slowdown in permille in the low half; for TENSE_EVENT_JOIN,
+ *		TENSE_EVENT_LEAVE and TENSE_EVENT_SWITCH the index of the task
+ *		in its experiment; for
+ *		TENSE_EVENT_FORWARD the virtual ns skipped; for
+ *		TENSE_EVENT_MIGRATE the virtual ns the task skips joining the
+ *		timeline of its new CPU; for TENSE_EVENT_FAULT the virtual
+ *		cost charged, with the top bit set for a major fault
+ * @pid:	task the event is about, 0 for TENSE_EVENT_ADAPT and
+ *		TENSE_EVENT_FORWARD which are about a whole experiment at its
+ *		min_time @time
+ * @cpu:	CPU that recorded the event
+ * @type:	one of TENSE_EVENT_*
+ *
+ * Records come out ordered by @clock within a CPU but not across CPUs.
+ */
+struct tense_event {
+	__u64 clock;
+	__u64 time;
+	__u64 arg;
+	__u32 pid;
+	__u16 cpu;
+	__u16 type;
+};
+
+/* SECTION Schedule replay */
+
+/*
+ * struct tense_replay_entry - one step of a schedule written to tense_replay
+ *
+ * @index:	task to switch in, by the order in which it joined the
+ *		experiment, the arg of its TENSE_EVENT_SWITCH
+ * @reserved:	must be 0
+ * @time:	virtual time of the task when it was switched in on record
+ *
+ * A schedule is the TENSE_EVENT_SWITCH events of a recorded run ordered by
+ * clock, with consecutive steps of the same task merged.
+ */
+struct tense_replay_entry {
+	__u32 index;
+	__u32 reserved;
+	__u64 time;
+};
+
+/* SECTION Control commands */
+
+#define TENSE_ABI_VERSION	2
+
+#define TENSE_CMD_TDF		1
+#define TENSE_CMD_MOVE		2
+#define TENSE_CMD_SLEEP		3
+#define TENSE_CMD_IO		4
+#define TENSE_CMD_IO_FACTOR	5
+#define TENSE_CMD_MODE_TDF	6
+
+#define TENSE_MODE_KERNEL	1
+#define TENSE_MODE_IRQ		2
+
+#define TENSE_BATCH_MAX		64
+
+/*
+ * struct tense_cmd - one control operation of a batch
+ *
+ * @type:	one of TENSE_CMD_*
+ * @flags:	must be 0
+ * @tdf:	TENSE_CMD_TDF sets the time dilation factor to faster / slower,
+ *		neither may be 0
+ * @ns:		TENSE_CMD_MOVE moves forward by @ns of real time, scaled by the
+ *		current factor; TENSE_CMD_SLEEP sleeps for @ns of virtual time;
+ *		TENSE_CMD_IO predicts @ns for the next blocking I/O
+ * @io_factor:	TENSE_CMD_IO_FACTOR charges I/O on block device @dev, as
+ *		encoded in st_rdev, its measured time times slower / faster;
+ *		a @dev of 0 applies to all other devices
+ * @mode_tdf:	TENSE_CMD_MODE_TDF charges the time the caller spends in
+ *		@mode, one of TENSE_MODE_*, at slower / faster rather than at
+ *		its time dilation factor; a @slower of 0 leaves that time out of
+ *		virtual time and 0 for both goes back to the factor
+ */
+struct tense_cmd {
+	__u32 type;
+	__u32 flags;
+	union {
+		struct {
+			__u32 faster;
+			__u32 slower;
+		} tdf;
+		struct {
+			__u32 dev;
+			__u32 faster;
+			__u32 slower;
+		} io_factor;
+		struct {
+			__u32 mode;
+			__u32 faster;
+			__u32 slower;
+		} mode_tdf;
+		__u64 ns;
+	};
+};
+
+/*
+ * struct tense_batch - argument of TENSE_IOC_BATCH
+ *
+ * @version:	TENSE_ABI_VERSION the caller was built against
+ * @nr:		number of commands, at most TENSE_BATCH_MAX
+ * @cmds:	user address of an array of @nr struct tense_cmd
+ * @done:	set to the number of commands that completed
+ * @reserved:	must be 0
+ * @time:	set to the virtual time of the caller after the batch
+ *
+ * Commands run in order as if each was a separate call, and the batch stops at
+ * the first one that fails. An empty batch only reads the time.
+ */
+struct tense_batch {
+	__u32 version;
+	__u32 nr;
+	__u64 cmds;
+	__u32 done;
+	__u32 reserved;
+	__u64 time;
+};
+
+#define TENSE_IOC_MAGIC		0xf5
+#define TENSE_IOC_BATCH		_IOWR(TENSE_IOC_MAGIC, 1, struct tense_batch)
+
+/*
+ * Stores the id of the caller, its index in the experiment plus one, which
+ * names it in the timelines of the shared page. Unlike a pid it is the same in
+ * every pid namespace.
+ */
+#define TENSE_IOC_ID		_IOR(TENSE_IOC_MAGIC, 2, __u32)
+
+#endif /* _UAPI_TENSE_H */
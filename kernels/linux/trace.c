@@ -0,0 +1,136 @@
+#include <linux/atomic.h>
+#include <linux/fs.h>
+#include <linux/jump_label.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/ring_buffer.h>
+#include <linux/sched/clock.h>
+#include <linux/uaccess.h>
+
+#define CREATE_TRACE_POINTS
+#include "tense_trace.h"
+
+/*
+ * Binary events go to a ring buffer with one lock-free writer per CPU, the
+ * same as the ftrace buffer behind trace_pipe. Recording is patched out unless
+ * someone has the events file open.
+ */
+static struct ring_buffer *events;
+
+DEFINE_STATIC_KEY_FALSE(tense_events_enabled);
+
+// Records which did not fit because the reader fell behind
+static DEFINE_PER_CPU(u64, events_dropped);
+
+// Only one reader at a time, it owns the reader pages of the buffer
+static atomic_t events_open = ATOMIC_INIT(0);
+
+int tense_events_init(unsigned long size)
+{
+	events = ring_buffer_alloc(size, 0);
+
+	return events ? 0 : -ENOMEM;
+}
+
+void tense_events_exit(void)
+{
+	ring_buffer_free(events);
+}
+
+/*
+ * Called from the scheduler hooks with interrupts disabled, but also safe from
+ * any other context. Never blocks and never takes a lock.
+ */
+void __tense_event(u16 type, pid_t pid, u64 time, u64 arg)
+{
+	struct tense_event ev = {
+		.clock	= local_clock(),
+		.time	= time,
+		.arg	= arg,
+		.pid	= pid,
+		.cpu	= raw_smp_processor_id(),
+		.type	= type,
+	};
+
+	if (ring_buffer_write(events, sizeof(ev), &ev))
+		this_cpu_inc(events_dropped);
+}
+
+u64 tense_events_dropped(void)
+{
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += per_cpu(events_dropped, cpu);
+
+	return sum;
+}
+
+/*
+ * Opening the file starts recording from an empty buffer, closing it stops.
+ */
+static int
+open_events(struct inode *inode, struct file *filp)
+{
+	int cpu;
+
+	if (atomic_cmpxchg(&events_open, 0, 1))
+		return -EBUSY;
+
+	ring_buffer_reset(events);
+	for_each_possible_cpu(cpu)
+		per_cpu(events_dropped, cpu) = 0;
+
+	static_branch_enable(&tense_events_enabled);
+
+	return nonseekable_open(inode, filp);
+}
+
+/*
+ * Reading returns as many whole struct tense_event records as fit in @count,
+ * taken from each CPU in turn. It doesn't wait, a return of 0 only means that
+ * nothing is buffered right now, so a streaming reader polls.
+ */
+static ssize_t
+read_events(struct file *filp, char __user *buf, size_t count, loff_t *offp)
+{
+	struct ring_buffer_event *rbe;
+	struct tense_event ev;
+	size_t copied = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		while (count - copied >= sizeof(ev)) {
+			rbe = ring_buffer_consume(events, cpu, NULL, NULL);
+			if (!rbe)
+				break;
+
+			// The reader page is ours until the next consume
+			memcpy(&ev, ring_buffer_event_data(rbe), sizeof(ev));
+
+			if (copy_to_user(buf + copied, &ev, sizeof(ev)))
+				return copied ? copied : -EFAULT;
+
+			copied += sizeof(ev);
+		}
+	}
+
+	return copied;
+}
+
+static int
+release_events(struct inode *inode, struct file *filp)
+{
+	static_branch_disable(&tense_events_enabled);
+	atomic_set(&events_open, 0);
+	return 0;
+}
+
+const struct file_operations tense_events_fops = {
+	.owner          = THIS_MODULE,
+	.open           = open_events,
+	.read           = read_events,
+	.llseek         = no_llseek,
+	.release        = release_events,
+};
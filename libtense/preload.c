@@ -112,12 +112,8 @@ int clock_gettime(clockid_t clk_id, struct timespec *tp) {
     if (!enabled)
         return clock_gettime_real(clk_id, tp);
 
-    if (clk_id == CLOCK_MONOTONIC) {
-        // Hack to update virtual time before reading it
-        clock_gettime_real(CLOCK_THREAD_CPUTIME_ID, tp);
-
+    if (clk_id == CLOCK_MONOTONIC)
         return tense_time(tp);
-    }
 
     return clock_gettime_real(clk_id, tp);
 }
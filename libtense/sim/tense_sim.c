@@ -0,0 +1,617 @@
+/*
+ * Usage:
+ *
+ *   ./tense_sim [-c cpus] [-t tick ns] [-f us] [-q] <trace>
+ *
+ * Discrete event simulation of one experiment of the tense module, driven by a
+ * workload trace instead of real tasks, so that changes to the core and what-if
+ * studies can be tried on any machine and far faster than real time. Virtual
+ * time goes through tense_core.h and tense_scale.h exactly as in the module;
+ * the scheduler around it is round robin per CPU at every tick in place of CFS.
+ *
+ * The trace has one task per block, pinned to a CPU, with its operations:
+ *
+ *   task <name> <cpu>
+ *   run <duration>       runs for a duration of real time
+ *   sleep <duration>     sleeps for a duration of virtual time
+ *   tdf <faster> <slower>
+ *   move <duration>      moves forward as if it had run, scaled by its factor
+ *
+ * Durations are in ns or take a suffix of us, ms or s. A # starts a comment.
+ * With -f, virtual time jumps to the next wakeup once no task has been runnable
+ * for <us> after the last one went to sleep, like fast_forward_us of the module.
+ *
+ * Output:
+ *
+ *   Unless -q, tab-separated real ns, cpu, task, event, virtual ns, argument
+ *   for each event, as tense_events prints them; then one line per task of
+ *   task, name, cpu, real ns at exit, virtual ns at exit, ns run, sleeps
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "tense_core.h"
+
+#define MAX_CPUS 64
+#define MAX_TASKS 256
+
+// The module drops a CPU from the minimum after two ticks without updates
+#define STALE_TICKS 2
+
+enum { OP_RUN, OP_SLEEP, OP_TDF, OP_MOVE };
+
+struct op {
+    int type;
+    __u64 ns;
+    __u32 faster;
+    __u32 slower;
+};
+
+enum { RUNNABLE, SLEEPING, DONE };
+
+struct task {
+    char name[32];
+    int cpu;
+    struct op * ops;
+    size_t nr_ops;
+    size_t cap_ops;
+    size_t pc;
+    __u64 left;
+    int state;
+
+    __u64 vtime;
+    __u64 wakeup_time;
+
+    __u32 base_faster;
+    __u32 base_slower;
+    __u32 faster;
+    __u32 slower;
+    __u64 scale_mult;
+    __u64 inv_mult;
+    __u32 scale_shift;
+    __u32 inv_shift;
+
+    __u64 exec;
+    __u64 sleeps;
+    __u64 end_real;
+    __u64 end_virtual;
+};
+
+struct cpu {
+    int curr;
+    int queue[MAX_TASKS];
+    int head;
+    int nr;
+
+    __u64 time;
+    __u64 updated;
+    int active;
+    __u64 timer;
+};
+
+static struct task tasks[MAX_TASKS];
+static int nr_tasks;
+
+static struct cpu cpus[MAX_CPUS];
+static int nr_cpus = 1;
+
+static __u64 now;
+static __u64 tick = 4000000;
+static __u64 min_time;
+static int quiet;
+
+static int forward;
+static __u64 forward_ns;
+static __u64 forward_at = TENSE_TIME_MAX;
+
+static void
+event(int cpu, const struct task * t, const char * name, __u64 vtime, __u64 arg)
+{
+    if (!quiet)
+        printf("%llu\t%d\t%s\t%s\t%llu\t%llu\n", (unsigned long long) now, cpu,
+               t->name, name, (unsigned long long) vtime,
+               (unsigned long long) arg);
+}
+
+/* SECTION The module's hooks, see main.c */
+
+static void set_task_tdf(struct task * t) {
+    tense_compose_tdf(&t->faster, &t->slower, t->base_faster, t->base_slower,
+                      1, 1, 1000);
+    tense_scale_calc(&t->scale_mult, &t->scale_shift, t->slower, t->faster);
+    tense_scale_calc(&t->inv_mult, &t->inv_shift, t->faster, t->slower);
+}
+
+static void update_curr(int c, __u64 delta_exec) {
+    struct cpu * cpu = &cpus[c];
+    struct task * t = &tasks[cpu->curr];
+
+    cpu->time += tense_scale_apply(delta_exec, t->scale_mult, t->scale_shift);
+    cpu->updated = now;
+    t->vtime = cpu->time;
+}
+
+static void switch_in(int c, int id) {
+    struct cpu * cpu = &cpus[c];
+    struct task * t = &tasks[id];
+
+    cpu->time = tense_timeline_join(cpu->time, cpu->active, min_time, t->vtime);
+    cpu->active = 1;
+    cpu->updated = now;
+    cpu->curr = id;
+    t->vtime = cpu->time;
+}
+
+static __u64 cpu_time(int c) {
+    return tense_cpu_time(cpus[c].active, cpus[c].time, min_time);
+}
+
+static void update_min_time(void) {
+    __u64 min = TENSE_TIME_MAX;
+
+    for (int c = 0; c < nr_cpus; ++c) {
+        if (!cpus[c].active)
+            continue;
+
+        if (now > cpus[c].updated + STALE_TICKS * tick) {
+            cpus[c].active = 0;
+            continue;
+        }
+
+        if (cpus[c].time < min)
+            min = cpus[c].time;
+    }
+
+    min_time = tense_min_advance(min_time, min);
+}
+
+static void enqueue(int c, int id) {
+    struct cpu * cpu = &cpus[c];
+
+    cpu->queue[(cpu->head + cpu->nr++) % MAX_TASKS] = id;
+}
+
+static int dequeue(int c) {
+    struct cpu * cpu = &cpus[c];
+    int id = cpu->queue[cpu->head];
+
+    cpu->head = (cpu->head + 1) % MAX_TASKS;
+    cpu->nr--;
+    return id;
+}
+
+static void wake(struct task * t, __u64 vtime) {
+    event(t->cpu, t, "wakeup", vtime, t->wakeup_time);
+    t->state = RUNNABLE;
+    t->wakeup_time = TENSE_TIME_MAX;
+    enqueue(t->cpu, (int) (t - tasks));
+}
+
+/*
+ * Program the timer of @c for when its first sleeper is due at the factor of
+ * the task running there, if any, like program_sleepers.
+ */
+static void program_sleepers(int c) {
+    __u64 wakeup = TENSE_TIME_MAX, vnow = cpu_time(c);
+
+    for (int i = 0; i < nr_tasks; ++i) {
+        if (tasks[i].state == SLEEPING && tasks[i].cpu == c
+            && tasks[i].wakeup_time < wakeup)
+            wakeup = tasks[i].wakeup_time;
+    }
+
+    if (wakeup == TENSE_TIME_MAX) {
+        cpus[c].timer = TENSE_TIME_MAX;
+        return;
+    }
+
+    if (cpus[c].curr != -1) {
+        const struct task * curr = &tasks[cpus[c].curr];
+
+        cpus[c].timer = now + tense_wakeup_delay(wakeup, vnow, curr->inv_mult,
+                                                 curr->inv_shift);
+    } else {
+        cpus[c].timer = now + (wakeup > vnow ? wakeup - vnow : 0);
+    }
+}
+
+static void wake_up_cpu_sleepers(int c, __u64 vnow) {
+    for (int i = 0; i < nr_tasks; ++i) {
+        struct task * t = &tasks[i];
+
+        if (t->state == SLEEPING && t->cpu == c && t->wakeup_time <= vnow)
+            wake(t, vnow);
+    }
+
+    program_sleepers(c);
+}
+
+static void wake_up_sleepers(int c) {
+    wake_up_cpu_sleepers(c, cpu_time(c));
+
+    for (int other = 0; other < nr_cpus; ++other) {
+        if (other != c && !cpus[other].active)
+            wake_up_cpu_sleepers(other, min_time);
+    }
+}
+
+/*
+ * Nothing is runnable, so jump to the earliest wakeup like fast_forward in the
+ * module. All timelines go stale and their sleepers follow the minimum.
+ */
+static void fast_forward(void) {
+    __u64 earliest = TENSE_TIME_MAX;
+
+    for (int i = 0; i < nr_tasks; ++i) {
+        if (tasks[i].state == SLEEPING && tasks[i].wakeup_time < earliest)
+            earliest = tasks[i].wakeup_time;
+    }
+
+    if (earliest == TENSE_TIME_MAX)
+        return;
+
+    for (int c = 0; c < nr_cpus; ++c)
+        cpus[c].active = 0;
+
+    if (earliest > min_time && !quiet)
+        printf("%llu\t-\t-\tforward\t%llu\t%llu\n", (unsigned long long) now,
+               (unsigned long long) earliest,
+               (unsigned long long) (earliest - min_time));
+
+    min_time = tense_min_advance(min_time, earliest);
+
+    for (int c = 0; c < nr_cpus; ++c)
+        wake_up_cpu_sleepers(c, min_time);
+}
+
+/* SECTION Workload */
+
+/*
+ * Carry out the operations of the task on @c which take no real time, up to
+ * the next run. The task gives up the CPU if it goes to sleep or exits.
+ */
+static void advance(int c) {
+    struct cpu * cpu = &cpus[c];
+    struct task * t = &tasks[cpu->curr];
+
+    for (; t->pc < t->nr_ops; ++t->pc) {
+        const struct op * op = &t->ops[t->pc];
+
+        switch (op->type) {
+        case OP_RUN:
+            if (!t->left)
+                t->left = op->ns;
+            if (t->left)
+                return;
+            break;
+
+        case OP_TDF:
+            t->base_faster = op->faster;
+            t->base_slower = op->slower;
+            set_task_tdf(t);
+            event(c, t, "tdf", t->vtime,
+                  (__u64) t->faster << 32 | t->slower);
+            program_sleepers(c);
+            break;
+
+        case OP_MOVE:
+            update_curr(c, op->ns);
+            event(c, t, "move", t->vtime, op->ns);
+            break;
+
+        case OP_SLEEP: {
+            __u64 time = cpu_time(c);
+
+            t->wakeup_time = (time > t->vtime ? time : t->vtime) + op->ns;
+            t->state = SLEEPING;
+            t->sleeps++;
+            t->pc++;
+            if (forward)
+                forward_at = now + forward_ns;
+            event(c, t, "sleep", t->vtime, t->wakeup_time);
+            cpu->curr = -1;
+            program_sleepers(c);
+            return;
+        }
+        }
+    }
+
+    t->state = DONE;
+    t->end_real = now;
+    t->end_virtual = t->vtime;
+    event(c, t, "exit", t->vtime, 0);
+    cpu->curr = -1;
+}
+
+static void pick(int c) {
+    while (cpus[c].curr == -1 && cpus[c].nr) {
+        switch_in(c, dequeue(c));
+        program_sleepers(c);
+        advance(c);
+    }
+}
+
+/*
+ * Run until every task has exited. Stops early if all of them sleep in virtual
+ * time with nothing left to move it, which the module can't get out of either
+ * without fast-forward.
+ */
+static int simulate(void) {
+    __u64 next_tick = tick;
+    int done = 0;
+
+    for (int i = 0; i < nr_tasks; ++i) {
+        tasks[i].state = RUNNABLE;
+        enqueue(tasks[i].cpu, i);
+    }
+
+    while (done < nr_tasks) {
+        int running = 0, due = 0;
+        __u64 next = next_tick;
+
+        for (int c = 0; c < nr_cpus; ++c) {
+            pick(c);
+            if (cpus[c].curr == -1)
+                continue;
+
+            running = 1;
+            if (now + tasks[cpus[c].curr].left < next)
+                next = now + tasks[cpus[c].curr].left;
+        }
+
+        for (int c = 0; c < nr_cpus; ++c) {
+            if (cpus[c].timer < next)
+                next = cpus[c].timer;
+        }
+
+        // Without a running task only sleepers due already can wake up
+        for (int i = 0; i < nr_tasks; ++i) {
+            if (tasks[i].state == SLEEPING
+                && tasks[i].wakeup_time <= cpu_time(tasks[i].cpu))
+                due = 1;
+        }
+
+        if (forward_at < next)
+            next = forward_at;
+
+        done = 0;
+        for (int i = 0; i < nr_tasks; ++i)
+            done += tasks[i].state == DONE;
+        if (done == nr_tasks)
+            break;
+
+        if (!running && !due && forward_at == TENSE_TIME_MAX) {
+            fprintf(stderr, "stalled at %llu ns: every task sleeps in virtual "
+                    "time\n", (unsigned long long) now);
+            return -1;
+        }
+
+        for (int c = 0; c < nr_cpus; ++c) {
+            if (cpus[c].curr == -1)
+                continue;
+
+            struct task * t = &tasks[cpus[c].curr];
+            __u64 delta = next - now;
+
+            t->exec += delta;
+            t->left -= delta;
+        }
+
+        // Timelines advance over the whole interval, as of its end
+        __u64 start = now;
+        now = next;
+        for (int c = 0; c < nr_cpus; ++c) {
+            if (cpus[c].curr != -1)
+                update_curr(c, next - start);
+        }
+
+        for (int c = 0; c < nr_cpus; ++c) {
+            if (cpus[c].curr != -1 && !tasks[cpus[c].curr].left) {
+                tasks[cpus[c].curr].pc++;
+                advance(c);
+            }
+        }
+
+        for (int c = 0; c < nr_cpus; ++c) {
+            if (cpus[c].timer <= now) {
+                cpus[c].timer = TENSE_TIME_MAX;
+                wake_up_cpu_sleepers(c, cpu_time(c));
+            }
+        }
+
+        if (now == forward_at) {
+            int idle = 1;
+
+            forward_at = TENSE_TIME_MAX;
+            for (int i = 0; i < nr_tasks; ++i)
+                idle &= tasks[i].state != RUNNABLE;
+            if (idle)
+                fast_forward();
+        }
+
+        if (now == next_tick) {
+            for (int c = 0; c < nr_cpus; ++c) {
+                if (cpus[c].curr == -1)
+                    continue;
+
+                update_min_time();
+                wake_up_sleepers(c);
+
+                // Round robin among the runnable tasks of the CPU
+                if (cpus[c].nr) {
+                    enqueue(c, cpus[c].curr);
+                    cpus[c].curr = -1;
+                }
+            }
+            next_tick += tick;
+        }
+    }
+
+    return 0;
+}
+
+/* SECTION Trace parsing */
+
+static int parse_duration(const char * s, __u64 * ns) {
+    char * end;
+    unsigned long long n = strtoull(s, &end, 10);
+
+    if (end == s)
+        return -1;
+
+    if (!*end || !strcmp(end, "ns"))
+        *ns = n;
+    else if (!strcmp(end, "us"))
+        *ns = n * 1000;
+    else if (!strcmp(end, "ms"))
+        *ns = n * 1000000;
+    else if (!strcmp(end, "s"))
+        *ns = n * 1000000000;
+    else
+        return -1;
+
+    return 0;
+}
+
+static int add_op(struct task * t, const struct op * op) {
+    if (t->nr_ops == t->cap_ops) {
+        size_t cap = t->cap_ops ? 2 * t->cap_ops : 16;
+        struct op * ops = realloc(t->ops, cap * sizeof(*ops));
+
+        if (!ops)
+            return -1;
+        t->ops = ops;
+        t->cap_ops = cap;
+    }
+
+    t->ops[t->nr_ops++] = *op;
+    return 0;
+}
+
+static int parse(FILE * f) {
+    char line[256], word[32], arg[32];
+    struct task * t = NULL;
+    struct op op;
+    int lineno = 0, n;
+
+    while (fgets(line, sizeof(line), f)) {
+        ++lineno;
+
+        char * hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+
+        memset(&op, 0, sizeof(op));
+        n = sscanf(line, "%31s %31s", word, arg);
+        if (n <= 0)
+            continue;
+
+        if (!strcmp(word, "task")) {
+            if (nr_tasks == MAX_TASKS)
+                goto bad_line;
+
+            t = &tasks[nr_tasks++];
+            memset(t, 0, sizeof(*t));
+            if (sscanf(line, "task %31s %d", t->name, &t->cpu) != 2
+                || t->cpu < 0 || t->cpu >= nr_cpus)
+                goto bad_line;
+
+            t->base_faster = t->base_slower = 1;
+            t->wakeup_time = TENSE_TIME_MAX;
+            set_task_tdf(t);
+            continue;
+        }
+
+        if (!t || n != 2)
+            goto bad_line;
+
+        if (!strcmp(word, "run"))
+            op.type = OP_RUN;
+        else if (!strcmp(word, "sleep"))
+            op.type = OP_SLEEP;
+        else if (!strcmp(word, "move"))
+            op.type = OP_MOVE;
+        else if (!strcmp(word, "tdf"))
+            op.type = OP_TDF;
+        else
+            goto bad_line;
+
+        if (op.type == OP_TDF) {
+            if (sscanf(line, "tdf %u %u", &op.faster, &op.slower) != 2
+                || !op.faster || !op.slower)
+                goto bad_line;
+        } else if (parse_duration(arg, &op.ns)) {
+            goto bad_line;
+        }
+
+        if (add_op(t, &op))
+            return -1;
+    }
+
+    return 0;
+
+bad_line:
+    fprintf(stderr, "bad trace line %d: %s", lineno, line);
+    return -1;
+}
+
+int main(int argc, char ** argv) {
+    FILE * f;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:t:f:q")) != -1) {
+        switch (opt) {
+        case 'c':
+            nr_cpus = atoi(optarg);
+            break;
+        case 't':
+            tick = strtoull(optarg, NULL, 10);
+            break;
+        case 'f':
+            forward = 1;
+            forward_ns = strtoull(optarg, NULL, 10) * 1000;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        default:
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1 || nr_cpus < 1 || nr_cpus > MAX_CPUS || !tick)
+        return EXIT_FAILURE;
+
+    for (int c = 0; c < nr_cpus; ++c) {
+        cpus[c].curr = -1;
+        cpus[c].timer = TENSE_TIME_MAX;
+    }
+
+    f = strcmp(argv[optind], "-") ? fopen(argv[optind], "r") : stdin;
+    if (!f) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    int err = parse(f);
+    if (f != stdin)
+        fclose(f);
+    if (err)
+        return EXIT_FAILURE;
+
+    err = simulate();
+
+    for (int i = 0; i < nr_tasks; ++i) {
+        const struct task * t = &tasks[i];
+
+        printf("task\t%s\t%d\t%llu\t%llu\t%llu\t%llu\n", t->name, t->cpu,
+               (unsigned long long) t->end_real,
+               (unsigned long long) t->end_virtual,
+               (unsigned long long) t->exec, (unsigned long long) t->sleeps);
+        free(t->ops);
+    }
+
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
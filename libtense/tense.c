@@ -1,22 +1,28 @@
 #define _GNU_SOURCE
 
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <syscall.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <errno.h>
 #include "tense.h"
+#include "tense_nop.h"
+#include "tense_scale.h"
+#include "tense_uapi.h"
 
 #define TENSE_FILE "/sys/kernel/debug/tense"
+#define TENSE_NOPS_FILE "/sys/module/tense/parameters/nops_per_ms"
 #define PAGE_SIZE 4096
 
 #define NS_IN_SECOND 1000000000
 #define MS_IN_SECOND 1000
 
-static __thread int vtime_fd;
 static __thread int tense_fd;
 
 #define FASTER 0
@@ -25,27 +31,72 @@ static __thread int tense_fd;
 static __thread uint32_t tense[2];
 
 static __thread void * tense_page = NULL;
+static __thread size_t tense_page_size;
+static __thread struct tense_warp * tense_warp = NULL;
+static __thread uint32_t tense_id;
+static __thread unsigned long long tense_last_ns;
+
+// Shared by all threads, 0 until the first call to tense_nops_per_ms
+static unsigned long tense_nops_ms = 0;
+
+/*
+ * Map the shared pages, first one of them to learn how many there are and then
+ * all. NULL if they can't be used.
+ */
+static void * tense_map_vvar(void) {
+    struct tense_vvar * vvar;
+    size_t size;
+
+    vvar = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, tense_fd, 0);
+    if (vvar == MAP_FAILED)
+        return NULL;
+
+    if (vvar->version != TENSE_VVAR_VERSION
+        || ioctl(tense_fd, TENSE_IOC_ID, &tense_id) == -1) {
+        munmap(vvar, PAGE_SIZE);
+        return NULL;
+    }
 
-int tense_init(void) {
-//    vtime_fd = open(TENSE_FILE, O_RDWR);
-//    if (vtime_fd < 0)
-//        return -1;
+    size = (size_t) vvar->pages * PAGE_SIZE;
+    if (size > PAGE_SIZE) {
+        munmap(vvar, PAGE_SIZE);
+        vvar = mmap(NULL, size, PROT_READ, MAP_SHARED, tense_fd, 0);
+        if (vvar == MAP_FAILED)
+            return NULL;
+    }
 
-//    tense_page = mmap(NULL, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, vtime_fd, 0);
-//    if (tense_page == MAP_FAILED)
-//        return -1;
-//
+    tense_page_size = size;
+    return vvar;
+}
 
+static int tense_open(int flags) {
     tense[FASTER] = 1;
     tense[SLOWER] = 1;
 
-    tense_fd = open(TENSE_FILE, O_RDWR);
+    tense_fd = open(TENSE_FILE, O_RDWR | flags);
     if (tense_fd < 0)
         goto bad_tense_open;
 
     if (write(tense_fd, (const void *) tense, 2 * sizeof(uint32_t)) == -1)
         goto bad_tense_write;
 
+    tense_last_ns = 0;
+
+    /*
+     * The shared pages are optional. Without them tense_time falls back to
+     * reading the file which costs a system call.
+     */
+    tense_page = tense_map_vvar();
+
+    // Optional as well, tense_warp_push fails without it
+    tense_warp = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      tense_fd, TENSE_WARP_PGOFF * PAGE_SIZE);
+    if (tense_warp == MAP_FAILED || tense_warp->version != TENSE_WARP_VERSION) {
+        if (tense_warp != MAP_FAILED)
+            munmap(tense_warp, PAGE_SIZE);
+        tense_warp = NULL;
+    }
+
     goto success;
 
 bad_tense_write:
@@ -58,7 +109,33 @@ success:
     return 0;
 }
 
+/*
+ * Join the experiment of the calling process, or of its parent process, or
+ * start a new one if neither is part of an experiment.
+ */
+int tense_init(void) {
+    return tense_open(0);
+}
+
+/*
+ * Start a new experiment isolated from any other running on the machine. Other
+ * threads of the process join it with tense_init.
+ */
+int tense_init_experiment(void) {
+    return tense_open(O_EXCL);
+}
+
 int tense_destroy(void) {
+    if (tense_page) {
+        munmap(tense_page, tense_page_size);
+        tense_page = NULL;
+    }
+
+    if (tense_warp) {
+        munmap(tense_warp, PAGE_SIZE);
+        tense_warp = NULL;
+    }
+
     if(close(tense_fd) == -1)
         return -1;
 
@@ -66,23 +143,31 @@ int tense_destroy(void) {
 }
 
 void tense_health_check(void) {
-    printf("Tense page at %lu\n", (unsigned long)tense_page);
-    unsigned long long * addr = tense_page;
-    while (*addr) {
-        printf("Init data %llu\n", *addr);
-        addr++;
-    }
+    struct tense_vvar * vvar = tense_page;
+    struct timespec page_tp, file_tp;
 
-    addr = tense_page;
-    for(unsigned long long i = 1; i < 20; i++) {
-        memcpy(addr++, &i, sizeof(unsigned long long));
+    printf("Tense page at %lu\n", (unsigned long)tense_page);
+    if (!vvar)
+        return;
+
+    printf("Version %u mult %u shift %u cpus %u\n", vvar->version, vvar->mult,
+           vvar->shift, vvar->nr_cpus);
+    for (unsigned int cpu = 0; cpu < vvar->nr_cpus; ++cpu) {
+        const struct tense_vvar_timeline * tl = &vvar->timelines[cpu];
+        if (!tl->seq)
+            continue;
+
+        printf("Timeline %u seq %u id %u time %llu cycles %llu tdf %u/%u scale %llu >> %u\n",
+               cpu, tl->seq, tl->id, (unsigned long long) tl->time,
+               (unsigned long long) tl->cycles, tl->faster, tl->slower,
+               (unsigned long long) tl->scale_mult, tl->scale_shift);
     }
 
-    addr = tense_page;
-    while (*addr) {
-        printf("Written data %llu\n", *addr);
-        addr++;
-    }
+    tense_time(&page_tp);
+    tense_time_syscall(&file_tp);
+    printf("Page time %lli file time %lli\n",
+           (long long) page_tp.tv_sec * NS_IN_SECOND + page_tp.tv_nsec,
+           (long long) file_tp.tv_sec * NS_IN_SECOND + file_tp.tv_nsec);
 }
 
 inline unsigned long long tense_rdtscp(void)
@@ -98,14 +183,93 @@ inline unsigned long long tense_rdtscp(void)
     return ((unsigned long long) low) | (((unsigned long long) high) << 32); // NOLINT
 }
 
+int tense_time_syscall(struct timespec *tp)
+{
+    return read(tense_fd, tp, sizeof(*tp)) == sizeof(*tp) ? 0 : -1;
+}
+
+static inline unsigned long long
+tense_rdtscp_cpu(unsigned int * cpu)
+{
+    unsigned int low, high, aux;
+
+    asm volatile(
+    "rdtscp"
+    : "=a" (low), "=d" (high), "=c" (aux));
+
+    // Linux keeps the node number above the low 12 bits of TSC_AUX
+    *cpu = aux & 0xfff;
+
+    return ((unsigned long long) low) | (((unsigned long long) high) << 32); // NOLINT
+}
+
+/*
+ * Extrapolate the virtual time from the last update published by the kernel,
+ * the same way vDSO clock_gettime works. The sequence count is odd while the
+ * module is writing and changes after every write.
+ *
+ * Returns -1 if the timeline of this CPU does not belong to the calling thread,
+ * e.g. right after a migration, and the kernel has to be asked instead.
+ */
+static int
+tense_time_vvar(const struct tense_vvar * vvar, unsigned long long * result)
+{
+    const struct tense_vvar_timeline * tl;
+    unsigned long long time, cycles, now, delta;
+    unsigned long long scale_mult;
+    uint32_t seq, faster, scale_shift;
+    unsigned int cpu;
+    uint32_t id;
+
+    now = tense_rdtscp_cpu(&cpu);
+    if (cpu >= vvar->nr_cpus)
+        return -1;
+
+    tl = &vvar->timelines[cpu];
+
+    do {
+        seq = __atomic_load_n(&tl->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        id = tl->id;
+        time = tl->time;
+        cycles = tl->cycles;
+        faster = tl->faster;
+        scale_mult = tl->scale_mult;
+        scale_shift = tl->scale_shift;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&tl->seq, __ATOMIC_RELAXED));
+
+    if (id != tense_id || !faster)
+        return -1;
+
+    delta = now > cycles ? now - cycles : 0;
+    delta = (unsigned long long) (((unsigned __int128) delta * vvar->mult) >> vvar->shift);
+    time += tense_scale_apply(delta, scale_mult, scale_shift);
+
+    // Never go back in time, the next kernel update may be slightly behind
+    if (time < tense_last_ns)
+        time = tense_last_ns;
+    tense_last_ns = time;
+
+    *result = time;
+    return 0;
+}
+
 int tense_time(struct timespec *tp)
 {
-    return read(tense_fd, tp, 0);
-//
-//    char buf[VRUNTIME_LEN];
-//    ssize_t bytes_read = read(tense_fd, buf, VRUNTIME_LEN);
-//    buf[bytes_read] = '\0';
-//    printf("TENSE time %s", buf);
+    unsigned long long now;
+
+    // The read brings the timeline up to date itself
+    if (!tense_page || tense_time_vvar(tense_page, &now) == -1)
+        return tense_time_syscall(tp);
+
+    tp->tv_sec = (time_t) (now / NS_IN_SECOND);
+    tp->tv_nsec = (long) (now % NS_IN_SECOND);
+
+    return 0;
 }
 
 long long tense_time_ms(void)
@@ -125,6 +289,7 @@ tense_time_point(const char * point_name)
         return -1;
 
     fprintf(stderr, "tense: %llu ms %s \n", time, point_name);
+    return 0;
 }
 
 int
@@ -135,11 +300,47 @@ tense_write(void)
     return 0;
 }
 
+static uint64_t
+gcd64(uint64_t a, uint64_t b)
+{
+    while (b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/*
+ * Scale the current time dilation factor by percent. The new factor is kept in
+ * lowest terms, and one that no longer fits fails with EOVERFLOW instead of
+ * wrapping around.
+ */
 int
 tense_scale_percent(int percent)
 {
-    tense[FASTER] *= percent;
-    tense[SLOWER] *= 100;
+    uint64_t faster, slower, g;
+
+    if (percent <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    faster = (uint64_t) tense[FASTER] * (uint64_t) percent;
+    slower = (uint64_t) tense[SLOWER] * 100;
+
+    g = gcd64(faster, slower);
+    faster /= g;
+    slower /= g;
+
+    if (faster > UINT32_MAX || slower > UINT32_MAX) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    tense[FASTER] = (uint32_t) faster;
+    tense[SLOWER] = (uint32_t) slower;
 
     return tense_write();
 }
@@ -153,15 +354,93 @@ tense_clear(void)
     return tense_write();
 }
 
+/*
+ * Speed up everything until the matching tense_warp_pop by percent, on top of
+ * the factor of the caller whatever it is. Nested pushes compose, 200 and then
+ * 400 make code run 8 times faster. Neither call enters the kernel, they only
+ * write to the warp stack page which the module picks up at the next tick, see
+ * struct tense_warp. tense_scale_percent and tense_clear leave the stack alone.
+ */
+int
+tense_warp_push(int percent)
+{
+    struct tense_warp * warp = tense_warp;
+    uint64_t faster = 1, slower = 1, g;
+    uint32_t depth;
+
+    if (!warp) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if (percent <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    depth = warp->depth;
+    if (depth == TENSE_WARP_DEPTH) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    if (depth) {
+        faster = warp->stack[depth - 1].faster;
+        slower = warp->stack[depth - 1].slower;
+    }
+
+    faster *= (uint64_t) percent;
+    slower *= 100;
+
+    g = gcd64(faster, slower);
+    faster /= g;
+    slower /= g;
+
+    if (faster > UINT32_MAX || slower > UINT32_MAX) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    warp->stack[depth].faster = (uint32_t) faster;
+    warp->stack[depth].slower = (uint32_t) slower;
+
+    // The module only runs on this CPU in between, in program order
+    __atomic_store_n(&warp->depth, depth + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&warp->seq, warp->seq + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/*
+ * Restore the factor from before the last tense_warp_push.
+ */
+int
+tense_warp_pop(void)
+{
+    struct tense_warp * warp = tense_warp;
+
+    if (!warp || !warp->depth) {
+        errno = warp ? EINVAL : ENOTSUP;
+        return -1;
+    }
+
+    __atomic_store_n(&warp->depth, warp->depth - 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&warp->seq, warp->seq + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
 int
 tense_sleep_ns(unsigned long long sleep_ns)
 {
-    lseek(tense_fd, (off_t)sleep_ns, SEEK_HOLE);
+    struct tense_cmd cmd = { .type = TENSE_CMD_SLEEP, .ns = sleep_ns };
+
+    return tense_batch(&cmd, 1, NULL);
 }
 
 int tense_sleep(const struct timespec * sleep)
 {
-    tense_sleep_ns((unsigned long long int) (sleep->tv_sec * NS_IN_SECOND + sleep->tv_nsec));
+    return tense_sleep_ns((unsigned long long int) (sleep->tv_sec * NS_IN_SECOND + sleep->tv_nsec));
 }
 
 
@@ -177,4 +456,212 @@ tense_move_ns(unsigned long long delta_ns)
 {
     off_t now = lseek(tense_fd, (off_t)delta_ns, SEEK_CUR);
     return (now == (off_t) -1) ? -1 : 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Run the given commands in order with a single system call. On success the
+ * virtual time after the last command is stored in now, unless it is NULL.
+ */
+int
+tense_batch(const struct tense_cmd * cmds, unsigned int nr, struct timespec * now)
+{
+    struct tense_batch batch = {
+        .version = TENSE_ABI_VERSION,
+        .nr = nr,
+        .cmds = (uintptr_t) cmds,
+    };
+
+    if (ioctl(tense_fd, TENSE_IOC_BATCH, &batch) == -1)
+        return -1;
+
+    if (now) {
+        now->tv_sec = (time_t) (batch.time / NS_IN_SECOND);
+        now->tv_nsec = (long) (batch.time % NS_IN_SECOND);
+    }
+
+    return 0;
+}
+
+int
+tense_set_tdf(unsigned int faster, unsigned int slower)
+{
+    struct tense_cmd cmd = {
+        .type = TENSE_CMD_TDF,
+        .tdf = { .faster = faster, .slower = slower },
+    };
+
+    if (tense_batch(&cmd, 1, NULL) == -1)
+        return -1;
+
+    tense[FASTER] = faster;
+    tense[SLOWER] = slower;
+    return 0;
+}
+
+/*
+ * Move forward by delta_ns of real time at percent speed and go back to the
+ * current time dilation factor, all in one system call. The same region takes
+ * three system calls with write() and lseek(). Fails with EINVAL unless percent
+ * is positive, before anything is sent to the kernel.
+ */
+int
+tense_move_percent_ns(unsigned long long delta_ns, int percent)
+{
+    if (percent <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct tense_cmd cmds[] = {
+        { .type = TENSE_CMD_TDF, .tdf = { .faster = (uint32_t) percent, .slower = 100 } },
+        { .type = TENSE_CMD_MOVE, .ns = delta_ns },
+        { .type = TENSE_CMD_TDF, .tdf = { .faster = tense[FASTER], .slower = tense[SLOWER] } },
+    };
+
+    return tense_batch(cmds, 3, NULL);
+}
+
+/*
+ * Charge the next blocking I/O of the calling thread io_ns of virtual time,
+ * whatever it takes in real time.
+ */
+int
+tense_predict_io_ns(unsigned long long io_ns)
+{
+    struct tense_cmd cmd = { .type = TENSE_CMD_IO, .ns = io_ns };
+
+    return tense_batch(&cmd, 1, NULL);
+}
+
+/*
+ * Charge blocking I/O on the given block device (e.g. "/dev/nvme0n1") its
+ * measured time scaled by slower / faster, for the whole experiment. A NULL
+ * device sets the factor for all other devices.
+ */
+int
+tense_io_factor(const char * device, unsigned int faster, unsigned int slower)
+{
+    struct tense_cmd cmd = {
+        .type = TENSE_CMD_IO_FACTOR,
+        .io_factor = { .faster = faster, .slower = slower },
+    };
+    struct stat st;
+
+    if (device) {
+        if (stat(device, &st) == -1)
+            return -1;
+
+        if (!S_ISBLK(st.st_mode)) {
+            errno = ENOTBLK;
+            return -1;
+        }
+
+        cmd.io_factor.dev = (uint32_t) st.st_rdev;
+    }
+
+    return tense_batch(&cmd, 1, NULL);
+}
+
+static int
+set_mode_tdf(uint32_t mode, unsigned int faster, unsigned int slower)
+{
+    struct tense_cmd cmd = {
+        .type = TENSE_CMD_MODE_TDF,
+        .mode_tdf = { .mode = mode, .faster = faster, .slower = slower },
+    };
+
+    return tense_batch(&cmd, 1, NULL);
+}
+
+/*
+ * Charge the time the calling thread spends in the kernel, in system calls and
+ * page faults, at slower / faster instead of its time dilation factor, e.g. to
+ * make application code faster while the kernel stays the same with 1/1. A
+ * slower of 0 leaves kernel time out of virtual time, and 0/0 goes back to
+ * the time dilation factor.
+ */
+int
+tense_set_kernel_tdf(unsigned int faster, unsigned int slower)
+{
+    return set_mode_tdf(TENSE_MODE_KERNEL, faster, slower);
+}
+
+/*
+ * The same for interrupts that land in the runtime of the calling thread.
+ */
+int
+tense_set_irq_tdf(unsigned int faster, unsigned int slower)
+{
+    return set_mode_tdf(TENSE_MODE_IRQ, faster, slower);
+}
+
+/*
+ * Same as calibrate_nops in the module, for when it isn't loaded.
+ */
+static unsigned long
+tense_calibrate_nops(void)
+{
+    const unsigned long long nops = 1 << 20;
+    struct timespec start, end;
+    long long delta, best = -1;
+
+    // The first run only warms up the CPU
+    tense_nops(nops);
+
+    for (int i = 0; i < 5; ++i) {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        tense_nops(nops);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+        delta = (end.tv_sec - start.tv_sec) * NS_IN_SECOND
+                + (end.tv_nsec - start.tv_nsec);
+        if (best == -1 || delta < best)
+            best = delta;
+    }
+
+    return (unsigned long) (nops * 1000000 / (best > 0 ? best : 1));
+}
+
+/*
+ * Iterations of the nop loop which take 1 ms of real time on this machine.
+ * Taken from the module, which recalibrates when the CPU frequency changes,
+ * or measured once by the process if the module isn't loaded.
+ */
+unsigned long
+tense_nops_per_ms(void)
+{
+    unsigned long nops = 0;
+    FILE * f = fopen(TENSE_NOPS_FILE, "r");
+
+    if (f) {
+        if (fscanf(f, "%lu", &nops) != 1)
+            nops = 0;
+        fclose(f);
+    }
+
+    if (nops)
+        __atomic_store_n(&tense_nops_ms, nops, __ATOMIC_RELAXED);
+    else if (!(nops = __atomic_load_n(&tense_nops_ms, __ATOMIC_RELAXED))) {
+        nops = tense_calibrate_nops();
+        __atomic_store_n(&tense_nops_ms, nops, __ATOMIC_RELAXED);
+    }
+
+    return nops;
+}
+
+/*
+ * Busy loop for about spin_ns of real time, whatever the speed of the
+ * machine, without reading any clock. A tense thread sees it take spin_ns
+ * scaled by its factor in virtual time. Uses the calibration from the last
+ * call to tense_nops_per_ms, or makes that call first.
+ */
+void
+tense_spin_ns(unsigned long long spin_ns)
+{
+    unsigned long nops = __atomic_load_n(&tense_nops_ms, __ATOMIC_RELAXED);
+
+    if (!nops)
+        nops = tense_nops_per_ms();
+
+    tense_nops(tense_nops_for_ns(spin_ns, nops));
+}
@@ -3,7 +3,10 @@
 
 #include <time.h>
 
+struct tense_cmd;
+
 int tense_init(void);
+int tense_init_experiment(void);
 
 int tense_destroy(void);
 
@@ -18,6 +21,7 @@ int tense_scale_percent(int percent);
 int tense_clear(void);
 
 int tense_time(struct timespec *);
+int tense_time_syscall(struct timespec *);
 long long tense_time_ms(void);
 int tense_time_point(const char * point_name);
 
@@ -27,14 +31,26 @@ int tense_sleep_ns(unsigned long long sleep_ns);
 int tense_move(const struct timespec * delta);
 int tense_move_ns(unsigned long long delta_ns);
 
+int tense_batch(const struct tense_cmd * cmds, unsigned int nr, struct timespec * now);
+int tense_set_tdf(unsigned int faster, unsigned int slower);
+int tense_move_percent_ns(unsigned long long delta_ns, int percent);
+
+int tense_predict_io_ns(unsigned long long io_ns);
+int tense_io_factor(const char * device, unsigned int faster, unsigned int slower);
+
+int tense_set_kernel_tdf(unsigned int faster, unsigned int slower);
+int tense_set_irq_tdf(unsigned int faster, unsigned int slower);
+
+int tense_warp_push(int percent);
+int tense_warp_pop(void);
+
+unsigned long tense_nops_per_ms(void);
+void tense_spin_ns(unsigned long long spin_ns);
+
 //void tense_blink(unsigned int nanos);
 //
 //void tense_blink_abs(unsigned int nanos);
 //
 //void tense_warp_set(int scale);
-//
-//void tense_warp_push(int scale);
-//
-//int tense_warp_pop(void);
 
 #endif
\ No newline at end of file
@@ -1,14 +1,33 @@
+/*
+ * Usage:
+ *
+ *   ./nop_calibration [ms]
+ *
+ * Prints the calibration libtense uses, from the module if it is loaded, then
+ * spins for <ms> (3 by default) ten times with tense_spin_ns and measures how
+ * long each run really took. On a calibrated host every run is close to <ms>.
+ *
+ * Output:
+ *
+ *   The nops per ms, then tab-separated run, wanted ns, measured ns
+ */
+
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include "../tense.h"
 
 #define ONE_BILLION 1000000000
 
 #define timespec_delta(s, e) ((e.tv_sec - s.tv_sec) * ONE_BILLION + (e.tv_nsec - s.tv_nsec))
 
 
-int main(void) {
+int main(int argc, char ** argv) {
     int type = CLOCK_MONOTONIC_RAW;
     struct timespec start, end;
+    long long spin_ns = (argc > 1 ? atol(argv[1]) : 3) * 1000000LL;
+
+    printf("Nops per ms %lu\n", tense_nops_per_ms());
 
     for(int i = 0; i < 10; ++i) {
         if (clock_gettime(type, &start) == -1) {
@@ -16,10 +35,7 @@ int main(void) {
             return -1;
         }
 
-        for (int j = 0; j < 3 * 500000; ++j)
-        {
-            asm("");
-        }
+        tense_spin_ns(spin_ns);
 
         if (clock_gettime(type, &end) == -1) {
             fprintf(stderr, "failed to get time\n");
@@ -28,7 +44,7 @@ int main(void) {
 
         long delta = timespec_delta(start, end);
 
-        printf("Nanos for nops %li\n", delta);
+        printf("%d\t%lld\t%li\n", i, spin_ns, delta);
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,149 @@
+/*
+ * Usage:
+ *
+ *   ./tense_batch <regions> <move ns>
+ *
+ * Runs an instrumented region which sets a time dilation factor, moves forward
+ * in virtual time and clears the factor, once through the old write() and
+ * lseek() interface and once as a single batch. Counts the system calls made
+ * by the thread with the raw_syscalls:sys_enter tracepoint, which needs access
+ * to tracefs and perf_event_paranoid allowing it.
+ *
+ * Output:
+ *
+ *   Tab-separated method, regions, syscalls per region, ns per region
+ */
+
+#define _GNU_SOURCE
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "../tense.h"
+
+#define ONE_BILLION 1000000000L
+#define timespec_delta(s, e) (((e).tv_sec - (s).tv_sec) * ONE_BILLION + ((e).tv_nsec - (s).tv_nsec))
+
+static const char * sys_enter_ids[] = {
+    "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+    "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+};
+
+static unsigned long long move_ns;
+
+/*
+ * Counter of system calls entered by the calling thread, or -1 if the
+ * tracepoint is not available.
+ */
+static int
+syscall_counter(void)
+{
+    struct perf_event_attr attr;
+    unsigned long long id;
+    FILE * f = NULL;
+
+    for (size_t i = 0; !f && i < sizeof(sys_enter_ids) / sizeof(*sys_enter_ids); ++i)
+        f = fopen(sys_enter_ids[i], "r");
+
+    if (!f)
+        return -1;
+
+    if (fscanf(f, "%llu", &id) != 1) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.size = sizeof(attr);
+    attr.config = id;
+    attr.disabled = 1;
+
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int
+region_legacy(void)
+{
+    if (tense_scale_percent(120) == -1 || tense_move_ns(move_ns) == -1)
+        return -1;
+
+    return tense_clear();
+}
+
+static int
+region_batch(void)
+{
+    return tense_move_percent_ns(move_ns, 120);
+}
+
+static int
+bench(const char * name, int (*region) (void), long regions, int counter)
+{
+    struct timespec start, end;
+    unsigned long long syscalls = 0;
+
+    if (counter != -1) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+    for (long i = 0; i < regions; ++i) {
+        if (region() == -1) {
+            fprintf(stderr, "%s failed\n", name);
+            return -1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+    if (counter != -1) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &syscalls, sizeof(syscalls)) != sizeof(syscalls))
+            syscalls = 0;
+    }
+
+    // The clock_gettime calls use the vDSO and don't show up
+    printf("%s\t%li\t%.2lf\t%.1lf\n", name, regions,
+           counter != -1 ? syscalls / (double) regions : -1.0,
+           timespec_delta(start, end) / (double) regions);
+    return 0;
+}
+
+int
+main(int argc, char ** argv)
+{
+    long regions = argc > 1 ? atol(argv[1]) : 100000;
+    int counter;
+
+    move_ns = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000;
+
+    if (tense_init() == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return EXIT_FAILURE;
+    }
+
+    counter = syscall_counter();
+    if (counter == -1)
+        fprintf(stderr, "raw_syscalls:sys_enter not available, not counting\n");
+
+    if (bench("legacy", region_legacy, regions, counter) == -1
+        || bench("batch", region_batch, regions, counter) == -1) {
+        tense_destroy();
+        return EXIT_FAILURE;
+    }
+
+    if (counter != -1)
+        close(counter);
+
+    tense_destroy();
+    return EXIT_SUCCESS;
+}
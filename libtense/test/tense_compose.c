@@ -0,0 +1,91 @@
+/*
+ * Usage:
+ *
+ *   ./tense_compose
+ *
+ * Checks tense_compose_tdf of tense_core.h, which the module and tense_sim
+ * share, against the exact ratio for factors up to and near 2^32, whose
+ * products don't fit in 64 bits. The composed ratios are all within what 32
+ * bits can express. Needs neither the module nor root.
+ *
+ * Output:
+ *
+ *   Tab-separated base faster, base slower, top faster, top slower, slowdown,
+ *   composed faster, composed slower, relative error of the composed ratio
+ *
+ * Exits with failure if a ratio which fits in 32 bits is not exact, or if any
+ * other is off by more than the rounding of its smaller term.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "tense_core.h"
+
+// Two primes just below 2^32
+#define P1 4294967291U
+#define P2 4294967279U
+
+static const uint32_t cases[][5] = {
+    { 1, 1, 1, 1, 1000 },
+    { 2, 1, 1, 1, 1000 },
+    { 3, 7, 5, 2, 1250 },
+    { 1, 1, 1, 1, 1 },
+    { 1, 1, 1, 1, UINT32_MAX },
+    { UINT32_MAX, 1, 1, 1, 1000 },
+    { 1, UINT32_MAX, 1, 1, 1000 },
+    { P1, P2, 1, 1, 1000 },
+    { P1, P2, P2, P1, 1000 },
+    { P1, P2, P1, P2, 1000 },
+    { P1, P2, P1, P2, 999 },
+    { P1, P2, P2, P1, P1 },
+    { P1, 1, 1, P2, 1000 },
+    { UINT32_MAX, 3, 5, UINT32_MAX - 4, 1024 },
+    { UINT32_MAX, UINT32_MAX - 1, UINT32_MAX - 1, UINT32_MAX, 1000 },
+};
+
+static unsigned __int128
+gcd128(unsigned __int128 a, unsigned __int128 b)
+{
+    while (b) {
+        unsigned __int128 t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); ++i) {
+        const uint32_t * c = cases[i];
+        unsigned __int128 f = (unsigned __int128) c[0] * c[2] * 1000;
+        unsigned __int128 s = (unsigned __int128) c[1] * c[3] * c[4];
+        unsigned __int128 g = gcd128(f, s);
+        __u32 faster, slower;
+        double error;
+
+        tense_compose_tdf(&faster, &slower, c[0], c[1], c[2], c[3], c[4]);
+
+        f /= g;
+        s /= g;
+        error = fabs((double) faster * (double) s / ((double) slower * (double) f) - 1);
+
+        if (f <= UINT32_MAX && s <= UINT32_MAX) {
+            if (faster != f || slower != s)
+                failed = 1;
+        } else if (error > 2.0 / (faster < slower ? faster : slower)) {
+            failed = 1;
+        }
+
+        printf("%u\t%u\t%u\t%u\t%u\t%u\t%u\t%.3g\n", c[0], c[1], c[2], c[3], c[4],
+               faster, slower, error);
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
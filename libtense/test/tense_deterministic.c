@@ -0,0 +1,100 @@
+/*
+ * Usage:
+ *
+ *   ./tense_deterministic <threads> <rounds> <work ms>
+ *
+ * Starts <threads> tense threads which each do <rounds> rounds of <work ms>
+ * of busy work, taking a shared mutex around every round, and prints the
+ * virtual time at which each round ends. With the module loaded with
+ * deterministic=1 and everything pinned to one CPU, the order of the rounds
+ * and their virtual times should come out about the same on every run, in
+ * particular under load from other programs.
+ *
+ * Output:
+ *
+ *   Tab-separated thread, round, virtual ns at the end of the round
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../tense.h"
+
+#define NSEC_IN_SEC 1000000000LL
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t barrier;
+static sem_t joined;
+
+static int rounds;
+static long long work_ns;
+
+static long long now_ns(void) {
+    struct timespec now;
+
+    tense_time(&now);
+    return now.tv_sec * NSEC_IN_SEC + now.tv_nsec;
+}
+
+static void * thread_routine(void * data) {
+    long id = (long) data;
+
+    int err = tense_init();
+
+    // Threads join one at a time in order of id, which names them in the module
+    sem_post(&joined);
+    pthread_barrier_wait(&barrier);
+
+    if (err == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return NULL;
+    }
+
+    for (int r = 0; r < rounds; ++r) {
+        pthread_mutex_lock(&mutex);
+        tense_spin_ns(work_ns);
+        printf("%ld\t%d\t%lld\n", id, r, now_ns());
+        pthread_mutex_unlock(&mutex);
+    }
+
+    tense_destroy();
+    return NULL;
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 4)
+        return EXIT_FAILURE;
+
+    int threads = atoi(argv[1]);
+    rounds = atoi(argv[2]);
+    work_ns = atol(argv[3]) * 1000000LL;
+
+    if (threads <= 0)
+        return EXIT_FAILURE;
+
+    pthread_t * handles = calloc(threads, sizeof(*handles));
+    if (!handles)
+        return EXIT_FAILURE;
+
+    // Calibrate once up front rather than in the first round
+    tense_nops_per_ms();
+
+    pthread_barrier_init(&barrier, NULL, threads);
+    sem_init(&joined, 0, 0);
+
+    for (long i = 0; i < threads; ++i) {
+        if (pthread_create(&handles[i], NULL, thread_routine, (void *) i))
+            return EXIT_FAILURE;
+        sem_wait(&joined);
+    }
+
+    for (int i = 0; i < threads; ++i)
+        pthread_join(handles[i], NULL);
+
+    pthread_barrier_destroy(&barrier);
+    sem_destroy(&joined);
+    free(handles);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+/*
+ * Usage:
+ *
+ *   ./tense_events <seconds>
+ *
+ * Streams the binary event buffer of the module for the given number of
+ * seconds (until interrupted by default) while tense programs run elsewhere.
+ * Recording only happens while this program has the events file open.
+ *
+ * Output:
+ *
+ *   Tab-separated clock, cpu, pid, event, virtual time, argument
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "tense_uapi.h"
+
+#define EVENTS_FILE "/sys/kernel/debug/tense_events"
+#define BATCH 4096
+#define POLL_US 10000
+
+static volatile sig_atomic_t exiting = 0;
+
+static const char * names[] = {
+    [TENSE_EVENT_UPDATE] = "update",
+    [TENSE_EVENT_SLEEP] = "sleep",
+    [TENSE_EVENT_WAKEUP] = "wakeup",
+    [TENSE_EVENT_TDF] = "tdf",
+    [TENSE_EVENT_MOVE] = "move",
+    [TENSE_EVENT_ADAPT] = "adapt",
+    [TENSE_EVENT_THROTTLE] = "throttle",
+    [TENSE_EVENT_JOIN] = "join",
+    [TENSE_EVENT_SWITCH] = "switch",
+    [TENSE_EVENT_FORWARD] = "forward",
+    [TENSE_EVENT_MIGRATE] = "migrate",
+    [TENSE_EVENT_FAULT] = "fault",
+    [TENSE_EVENT_LEAVE] = "leave",
+};
+
+static void
+stop(int sig)
+{
+    (void) sig;
+    exiting = 1;
+}
+
+int
+main(int argc, char ** argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 0;
+    static struct tense_event events[BATCH];
+    time_t end = time(NULL) + seconds;
+    ssize_t n;
+    int fd;
+
+    fd = open(EVENTS_FILE, O_RDONLY);
+    if (fd == -1) {
+        perror("failed to open " EVENTS_FILE);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    while (!exiting && (!seconds || time(NULL) < end)) {
+        n = read(fd, events, sizeof(events));
+        if (n == -1) {
+            perror("failed to read events");
+            break;
+        }
+
+        if (!n) {
+            usleep(POLL_US);
+            continue;
+        }
+
+        for (size_t i = 0; i < n / sizeof(*events); ++i) {
+            struct tense_event * ev = &events[i];
+            printf("%llu\t%u\t%u\t%s\t%llu\t%llu\n",
+                   (unsigned long long) ev->clock, ev->cpu, ev->pid,
+                   ev->type < sizeof(names) / sizeof(*names) && names[ev->type]
+                       ? names[ev->type] : "?",
+                   (unsigned long long) ev->time, (unsigned long long) ev->arg);
+        }
+    }
+
+    close(fd);
+    return EXIT_SUCCESS;
+}
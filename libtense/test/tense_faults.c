@@ -0,0 +1,123 @@
+/*
+ * Usage:
+ *
+ *   ./tense_faults <minor|major> <MiB> [file]
+ *
+ * Joins an experiment and touches every page of <MiB> of memory once, which
+ * takes a page fault per page. For minor faults the memory is anonymous. For
+ * major faults it is [file], at least <MiB> large, mapped after its pages are
+ * dropped from the page cache, so every page is read from disk. Load the
+ * module with fault_model=3 to have the faults charged minor_fault_ns and
+ * major_fault_ns instead of what they take; the virtual time per fault should
+ * then come out at about those values whatever the device, and the faults
+ * line of tense_stats shows the real time that was left out.
+ *
+ * Output:
+ *
+ *   Tab-separated kind, minor faults, major faults, real ns, virtual ns,
+ *   virtual ns per fault
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include "../tense.h"
+
+#define NSEC_IN_SEC 1000000000LL
+#define MIB (1L << 20)
+
+static long long ns_of(clockid_t clock) {
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+    return now.tv_sec * NSEC_IN_SEC + now.tv_nsec;
+}
+
+static long long virtual_ns(void) {
+    struct timespec now;
+
+    tense_time(&now);
+    return now.tv_sec * NSEC_IN_SEC + now.tv_nsec;
+}
+
+static char * map(int major, size_t size, const char * path) {
+    if (!major)
+        return mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return MAP_FAILED;
+
+    // Written back pages are dropped, so every access goes to the disk
+    fdatasync(fd);
+    posix_fadvise(fd, 0, (off_t) size, POSIX_FADV_DONTNEED);
+
+    char * mem = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    // One page per fault rather than what readahead brings in with it
+    if (mem != MAP_FAILED)
+        madvise(mem, size, MADV_RANDOM);
+    return mem;
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 3 && argc != 4)
+        return EXIT_FAILURE;
+
+    int major = !strcmp(argv[1], "major");
+    size_t size = (size_t) atol(argv[2]) * MIB;
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (!size || (major && argc != 4))
+        return EXIT_FAILURE;
+
+    char * mem = map(major, size, argv[3]);
+    if (mem == MAP_FAILED) {
+        perror("failed to map memory");
+        return EXIT_FAILURE;
+    }
+
+    if (tense_init() == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return EXIT_FAILURE;
+    }
+
+    struct rusage before, after;
+    volatile char sink = 0;
+
+    getrusage(RUSAGE_THREAD, &before);
+    long long real_start = ns_of(CLOCK_MONOTONIC);
+    long long virt_start = virtual_ns();
+
+    for (size_t off = 0; off < size; off += (size_t) page) {
+        if (major)
+            sink += mem[off];
+        else
+            mem[off] = 1;
+    }
+
+    long long virt = virtual_ns() - virt_start;
+    long long real = ns_of(CLOCK_MONOTONIC) - real_start;
+    getrusage(RUSAGE_THREAD, &after);
+
+    long minor_faults = after.ru_minflt - before.ru_minflt;
+    long major_faults = after.ru_majflt - before.ru_majflt;
+    long faults = minor_faults + major_faults;
+
+    printf("%s\t%ld\t%ld\t%lld\t%lld\t%.0f\n", major ? "major" : "minor",
+           minor_faults, major_faults, real, virt,
+           faults ? (double) virt / faults : 0.0);
+
+    (void) sink;
+    tense_destroy();
+    munmap(mem, size);
+    return EXIT_SUCCESS;
+}
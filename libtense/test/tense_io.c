@@ -0,0 +1,108 @@
+/*
+ * Usage:
+ *
+ *   ./tense_io <file> <device> <reads>
+ *
+ * Reads random 4 KiB blocks of the file with O_DIRECT so that every read
+ * blocks on the device, which should be the block device holding the file
+ * (e.g. /dev/nvme0n1). Runs three times: without any I/O model, predicting
+ * 1 ms for every read, and measuring reads on the device as if it were three
+ * times as fast.
+ *
+ * Output:
+ *
+ *   Tab-separated mode, reads, real ns per read, virtual ns per read
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../tense.h"
+
+#define ONE_BILLION 1000000000L
+#define ONE_MILLION 1000000ULL
+#define BLOCK 4096
+#define timespec_delta(s, e) (((e).tv_sec - (s).tv_sec) * ONE_BILLION + ((e).tv_nsec - (s).tv_nsec))
+
+enum mode { NONE, PREDICT, FACTOR };
+
+static const char * mode_names[] = { "none", "predict", "factor" };
+
+static int
+run(int fd, off_t blocks, long reads, enum mode mode, void * buf)
+{
+    struct timespec real_start, real_end, virt_start, virt_end;
+    unsigned int seed = 42;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &real_start);
+    tense_time(&virt_start);
+
+    for (long i = 0; i < reads; ++i) {
+        off_t block = (off_t) rand_r(&seed) % blocks;
+
+        if (mode == PREDICT)
+            tense_predict_io_ns(ONE_MILLION);
+
+        if (pread(fd, buf, BLOCK, block * BLOCK) != BLOCK) {
+            perror("failed to read");
+            return -1;
+        }
+    }
+
+    tense_time(&virt_end);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &real_end);
+
+    printf("%s\t%li\t%.1lf\t%.1lf\n", mode_names[mode], reads,
+           timespec_delta(real_start, real_end) / (double) reads,
+           timespec_delta(virt_start, virt_end) / (double) reads);
+    return 0;
+}
+
+int
+main(int argc, char ** argv)
+{
+    long reads = argc > 3 ? atol(argv[3]) : 1000;
+    struct stat st;
+    void * buf;
+    int fd, err = 0;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <file> <device> <reads>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    fd = open(argv[1], O_RDONLY | O_DIRECT);
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size < BLOCK) {
+        fprintf(stderr, "failed to open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    if (posix_memalign(&buf, BLOCK, BLOCK))
+        return EXIT_FAILURE;
+
+    if (tense_init_experiment() == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return EXIT_FAILURE;
+    }
+
+    err = run(fd, st.st_size / BLOCK, reads, NONE, buf)
+          || run(fd, st.st_size / BLOCK, reads, PREDICT, buf);
+
+    if (!err && tense_io_factor(argv[2], 3, 1) == -1) {
+        perror("failed to set the I/O factor");
+        err = 1;
+    }
+
+    if (!err)
+        err = run(fd, st.st_size / BLOCK, reads, FACTOR, buf);
+
+    tense_destroy();
+    free(buf);
+    close(fd);
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,17 +1,48 @@
+/*
+ * Usage:
+ *
+ *   ./tense_lock_race <input size>
+ *
+ * Two tense threads race for a mutex, main sped up with
+ * tense_scale_percent(900). Whoever blocks on the mutex must not resume before
+ * the virtual time at which the holder released it, which the module ensures
+ * by passing virtual time through the futex wakeup. Every time a thread gets
+ * the mutex after blocking, its virtual time is checked against the release.
+ *
+ * Output:
+ *
+ *   Time points on stderr, then the number of checks and failures
+ *
+ * Exits with failure if any check fails.
+ */
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <time.h>
 #include "../tense.h"
 
 #define NSEC_IN_SEC 1000000000L
 
-pthread_mutex_t mutex;
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Protected by mutex
+static long long released_ns = 0;
+static int checks = 0;
+static int failures = 0;
+
+static long long now_ns(void) {
+    struct timespec now;
+
+    tense_time(&now);
+    return now.tv_sec * NSEC_IN_SEC + now.tv_nsec;
+}
 
 void work(unsigned input_size) {
     unsigned n = input_size;
     n *= n * 100;
 
-    for (int i = 0; i < n; ++i) {
+    for (volatile int i = 0; i < n; ++i) {
         int j = i + n * i;
     }
 }
@@ -21,55 +52,72 @@ void critical(unsigned input_size, const char * caller_name) {
 
     if (fail) {
         tense_time_point("block point");
-        printf("%s was about to block\n", caller_name);
+        fprintf(stderr, "%s was about to block\n", caller_name);
         pthread_mutex_lock(&mutex);
+
+        long long acquired_ns = now_ns();
+        ++checks;
+        if (acquired_ns < released_ns) {
+            ++failures;
+            fprintf(stderr, "%s resumed at %lli before the release at %lli\n",
+                    caller_name, acquired_ns, released_ns);
+        }
     }
 
     work(10 * input_size);
+
+    released_ns = now_ns();
     pthread_mutex_unlock(&mutex);
 }
 
 void * thread_routine(void * data) {
     unsigned n = *(unsigned int *) data;
 
+    // Already a tense thread if started through preload with TENSE set
+    int own = tense_init() == 0;
+
     work(n);
     critical(n, "thread");
 
+    if (own)
+        tense_destroy();
     return NULL;
 }
 
 int main(int argc, char ** argv) {
-    struct timespec tense_start, tense_end;
     pthread_t other_thread;
 
     if (argc != 2)
-        return -1;
-
-    tense_init();
-    tense_time(&tense_start);
+        return EXIT_FAILURE;
 
+    if (tense_init() == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return EXIT_FAILURE;
+    }
 
     unsigned input = (unsigned int) atoi(argv[1]);
 
     if (pthread_create(&other_thread, NULL, thread_routine, &input)) {
-        return -1;
+        return EXIT_FAILURE;
     }
 
     tense_scale_percent(900);
 
     work(3 * input);
     critical(input, "main");
-    
+
     tense_clear();
 
     tense_time_point("main done");
 
     if (pthread_join(other_thread, NULL)) {
-        return -1;
+        return EXIT_FAILURE;
     }
 
     tense_time_point("thread joined");
 
+    printf("%d\t%d\n", checks, failures);
+
     tense_destroy();
-    return 0;
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,86 @@
+/*
+ * Usage:
+ *
+ *   ./tense_modes <user|kernel> <ms> <faster> <slower> [<kernel faster> <kernel slower>]
+ *
+ * Joins an experiment at a TDF of <faster>/<slower> and keeps busy for <ms>
+ * of CPU time, in user space with a plain loop or in the kernel by reading
+ * /dev/zero in large chunks. With the kernel factor given, time in the kernel
+ * is charged at <kernel slower>/<kernel faster> instead, 0 leaving it out.
+ * Virtual over CPU time should follow the TDF for the user loop and the
+ * kernel factor for the reads. The kernel_ns and overhead_ns lines of
+ * tense_stats show how much runtime went which way.
+ *
+ * Output:
+ *
+ *   Tab-separated mode, CPU ns, virtual ns, virtual / CPU
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../tense.h"
+
+#define NSEC_IN_SEC 1000000000LL
+#define NSEC_IN_MSEC 1000000LL
+#define CHUNK (1 << 20)
+
+static long long ns_of(clockid_t clock) {
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+    return now.tv_sec * NSEC_IN_SEC + now.tv_nsec;
+}
+
+static long long virtual_ns(void) {
+    struct timespec now;
+
+    tense_time(&now);
+    return now.tv_sec * NSEC_IN_SEC + now.tv_nsec;
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 5 && argc != 7)
+        return EXIT_FAILURE;
+
+    int kernel = !strcmp(argv[1], "kernel");
+    long long cpu_ns = atol(argv[2]) * NSEC_IN_MSEC;
+
+    char * buf = malloc(CHUNK);
+    int fd = open("/dev/zero", O_RDONLY);
+    if (!buf || fd == -1)
+        return EXIT_FAILURE;
+
+    if (tense_init() == -1 || tense_set_tdf(atoi(argv[3]), atoi(argv[4])) == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 7 && tense_set_kernel_tdf(atoi(argv[5]), atoi(argv[6])) == -1) {
+        fprintf(stderr, "failed to set the kernel factor\n");
+        return EXIT_FAILURE;
+    }
+
+    long long cpu_start = ns_of(CLOCK_THREAD_CPUTIME_ID);
+    long long virt_start = virtual_ns();
+
+    // Reads of /dev/zero spend nearly all of their time clearing the buffer
+    while (ns_of(CLOCK_THREAD_CPUTIME_ID) - cpu_start < cpu_ns) {
+        if (kernel && read(fd, buf, CHUNK) != CHUNK)
+            return EXIT_FAILURE;
+    }
+
+    long long virt = virtual_ns() - virt_start;
+    long long cpu = ns_of(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+    printf("%s\t%lld\t%lld\t%.2f\n", kernel ? "kernel" : "user", cpu, virt,
+           (double) virt / cpu);
+
+    tense_destroy();
+    close(fd);
+    free(buf);
+    return EXIT_SUCCESS;
+}
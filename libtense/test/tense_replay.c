@@ -0,0 +1,181 @@
+/*
+ * Usage:
+ *
+ *   ./tense_replay record <file>
+ *   ./tense_replay load <file>
+ *
+ * Record streams the event buffer of the module until interrupted while one
+ * experiment runs elsewhere, best with the module loaded with record=1, and
+ * saves the order in which its tasks were switched in to <file>. Load hands
+ * <file> to the module, and the next experiment started follows that order.
+ * Compare the replay line of tense_stats for how closely it did.
+ *
+ * Output:
+ *
+ *   The number of steps in the schedule
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "tense_uapi.h"
+
+#define EVENTS_FILE "/sys/kernel/debug/tense_events"
+#define REPLAY_FILE "/sys/kernel/debug/tense_replay"
+#define BATCH 4096
+#define POLL_US 10000
+
+static volatile sig_atomic_t exiting = 0;
+
+static void
+stop(int sig)
+{
+    (void) sig;
+    exiting = 1;
+}
+
+static int
+by_clock(const void * a, const void * b)
+{
+    const struct tense_event * x = a, * y = b;
+
+    return x->clock < y->clock ? -1 : x->clock > y->clock;
+}
+
+/*
+ * Events come out ordered by clock within a CPU only, so all switches are
+ * kept and sorted once recording stops.
+ */
+static int
+record(FILE * out)
+{
+    static struct tense_event events[BATCH];
+    struct tense_event * switches = NULL;
+    size_t nr = 0, cap = 0, steps = 0;
+    ssize_t n;
+    int fd;
+
+    fd = open(EVENTS_FILE, O_RDONLY);
+    if (fd == -1) {
+        perror("failed to open " EVENTS_FILE);
+        return -1;
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    while (!exiting) {
+        n = read(fd, events, sizeof(events));
+        if (n == -1) {
+            perror("failed to read events");
+            break;
+        }
+
+        if (!n) {
+            usleep(POLL_US);
+            continue;
+        }
+
+        for (size_t i = 0; i < n / sizeof(*events); ++i) {
+            if (events[i].type != TENSE_EVENT_SWITCH)
+                continue;
+
+            if (nr == cap) {
+                cap = cap ? 2 * cap : BATCH;
+                switches = realloc(switches, cap * sizeof(*switches));
+                if (!switches) {
+                    close(fd);
+                    return -1;
+                }
+            }
+            switches[nr++] = events[i];
+        }
+    }
+
+    close(fd);
+
+    qsort(switches, nr, sizeof(*switches), by_clock);
+
+    for (size_t i = 0; i < nr; ++i) {
+        struct tense_replay_entry entry = {
+            .index = (__u32) switches[i].arg,
+            .time = switches[i].time,
+        };
+
+        // The same task again after something outside the experiment ran
+        if (i && switches[i - 1].arg == switches[i].arg)
+            continue;
+
+        if (fwrite(&entry, sizeof(entry), 1, out) != 1) {
+            free(switches);
+            return -1;
+        }
+        ++steps;
+    }
+
+    free(switches);
+    printf("%zu\n", steps);
+    return 0;
+}
+
+static int
+load(FILE * in)
+{
+    static struct tense_replay_entry entries[BATCH];
+    size_t n, steps = 0;
+    int fd;
+
+    fd = open(REPLAY_FILE, O_WRONLY);
+    if (fd == -1) {
+        perror("failed to open " REPLAY_FILE);
+        return -1;
+    }
+
+    while ((n = fread(entries, sizeof(*entries), BATCH, in)) > 0) {
+        if (write(fd, entries, n * sizeof(*entries)) == -1) {
+            perror("failed to write schedule");
+            close(fd);
+            return -1;
+        }
+        steps += n;
+    }
+
+    // The schedule is handed over on close
+    if (close(fd) == -1)
+        return -1;
+
+    printf("%zu\n", steps);
+    return 0;
+}
+
+int
+main(int argc, char ** argv)
+{
+    FILE * f;
+    int err;
+
+    if (argc != 3)
+        return EXIT_FAILURE;
+
+    if (!strcmp(argv[1], "record")) {
+        f = fopen(argv[2], "wb");
+        if (!f)
+            return EXIT_FAILURE;
+        err = record(f);
+    } else if (!strcmp(argv[1], "load")) {
+        f = fopen(argv[2], "rb");
+        if (!f)
+            return EXIT_FAILURE;
+        err = load(f);
+    } else {
+        return EXIT_FAILURE;
+    }
+
+    if (fclose(f))
+        err = -1;
+
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+/*
+ * Usage:
+ *
+ *   sudo ./tense_rt <other|fifo|rr|deadline> <ms> <faster> <slower>
+ *
+ * Switches to the given scheduling policy, joins an experiment at a TDF of
+ * <faster>/<slower> and busy-waits for <ms> of CPU time. Whatever the policy,
+ * virtual time should advance by about the CPU time times <slower>/<faster>.
+ * Deadline runs with 10 ms of runtime every 20 ms, which stay in real time, so
+ * it takes about twice as long in real time without changing virtual time.
+ *
+ * Output:
+ *
+ *   Tab-separated policy, real ns, CPU ns, virtual ns, virtual / CPU
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "../tense.h"
+
+#define NSEC_IN_SEC 1000000000LL
+#define NSEC_IN_MSEC 1000000LL
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+// Not wrapped by older C libraries
+struct sched_attr {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+static long long ns_of(clockid_t clock) {
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+    return now.tv_sec * NSEC_IN_SEC + now.tv_nsec;
+}
+
+static long long virtual_ns(void) {
+    struct timespec now;
+
+    tense_time(&now);
+    return now.tv_sec * NSEC_IN_SEC + now.tv_nsec;
+}
+
+static int set_policy(const char * name) {
+    struct sched_param param = { .sched_priority = 1 };
+
+    if (!strcmp(name, "other"))
+        return 0;
+    if (!strcmp(name, "fifo"))
+        return sched_setscheduler(0, SCHED_FIFO, &param);
+    if (!strcmp(name, "rr"))
+        return sched_setscheduler(0, SCHED_RR, &param);
+
+    if (!strcmp(name, "deadline")) {
+        struct sched_attr attr = {
+            .size = sizeof(attr),
+            .sched_policy = SCHED_DEADLINE,
+            .sched_runtime = 10 * NSEC_IN_MSEC,
+            .sched_deadline = 20 * NSEC_IN_MSEC,
+            .sched_period = 20 * NSEC_IN_MSEC,
+        };
+
+        return (int) syscall(SYS_sched_setattr, 0, &attr, 0);
+    }
+
+    return -1;
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 5)
+        return EXIT_FAILURE;
+
+    long long cpu_ns = atol(argv[2]) * NSEC_IN_MSEC;
+
+    if (set_policy(argv[1])) {
+        perror("failed to set the scheduling policy");
+        return EXIT_FAILURE;
+    }
+
+    if (tense_init() == -1 || tense_set_tdf(atoi(argv[3]), atoi(argv[4])) == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return EXIT_FAILURE;
+    }
+
+    long long real_start = ns_of(CLOCK_MONOTONIC);
+    long long cpu_start = ns_of(CLOCK_THREAD_CPUTIME_ID);
+    long long virt_start = virtual_ns();
+
+    // Polls CPU time rather than spinning a set count, deadline gets throttled
+    while (ns_of(CLOCK_THREAD_CPUTIME_ID) - cpu_start < cpu_ns)
+        ;
+
+    long long virt = virtual_ns() - virt_start;
+    long long cpu = ns_of(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    long long real = ns_of(CLOCK_MONOTONIC) - real_start;
+
+    printf("%s\t%lld\t%lld\t%lld\t%.2f\n", argv[1], real, cpu, virt,
+           (double) virt / cpu);
+
+    tense_destroy();
+    return EXIT_SUCCESS;
+}
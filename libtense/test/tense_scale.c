@@ -0,0 +1,129 @@
+/*
+ * Usage:
+ *
+ *   ./tense_scale <samples> <iterations>
+ *
+ * Checks the division-free scaling of tense_scale.h against exact division for
+ * a range of time dilation factors, including extreme ones, and compares the
+ * cost of both. Needs neither the module nor root.
+ *
+ * Output:
+ *
+ *   Tab-separated faster, slower, samples, mismatches within the exact range,
+ *   max error in ns beyond it, ns per division, ns per multiply and shift
+ *
+ * Exits with failure if any sample within the exact range is off.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "tense_scale.h"
+
+#define ONE_BILLION 1000000000L
+#define timespec_delta(s, e) (((e).tv_sec - (s).tv_sec) * ONE_BILLION + ((e).tv_nsec - (s).tv_nsec))
+
+static const uint32_t factors[][2] = {
+    { 1, 1 },
+    { 1, 1000 },
+    { 1000, 1 },
+    { 120, 100 },
+    { 3, 7 },
+    { 999, 1000 },
+    { 1, 1024 },
+    { 1, UINT32_MAX },
+    { UINT32_MAX, 1 },
+    { UINT32_MAX, UINT32_MAX - 1 },
+};
+
+static uint64_t
+random_u64(void)
+{
+    return ((uint64_t) rand() << 42) ^ ((uint64_t) rand() << 21) ^ (uint64_t) rand();
+}
+
+static double
+bench_ns(const uint64_t * xs, long n, long iterations, uint32_t faster, uint32_t slower,
+         uint64_t mult, uint32_t shift, int divide)
+{
+    struct timespec start, end;
+    volatile uint64_t sink = 0;
+    uint64_t sum = 0;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+    for (long i = 0, j = 0; i < iterations; ++i, j = j + 1 < n ? j + 1 : 0) {
+        uint64_t x = xs[j];
+        if (divide)
+            sum += x * slower / faster;
+        else
+            sum += tense_scale_apply(x, mult, shift);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    sink = sum;
+    (void) sink;
+
+    return timespec_delta(start, end) / (double) iterations;
+}
+
+int
+main(int argc, char ** argv)
+{
+    long samples = argc > 1 ? atol(argv[1]) : 1000000;
+    long iterations = argc > 2 ? atol(argv[2]) : 100000000;
+    int failed = 0;
+    uint64_t * xs;
+
+    xs = calloc((size_t) samples, sizeof(*xs));
+    if (!xs)
+        return EXIT_FAILURE;
+
+    srand(42);
+
+    for (size_t f = 0; f < sizeof(factors) / sizeof(*factors); ++f) {
+        uint32_t faster = factors[f][0], slower = factors[f][1];
+        uint32_t g = tense_gcd(faster, slower);
+        unsigned __int128 limit = ((unsigned __int128) 1 << 61) / (slower / g);
+        __u64 mult;
+        __u32 shift;
+        uint64_t max_error = 0;
+        long mismatches = 0;
+
+        tense_scale_calc(&mult, &shift, slower, faster);
+
+        for (long i = 0; i < samples; ++i) {
+            // Mostly tick-sized deltas, sometimes huge ones
+            uint64_t x = i % 4 ? random_u64() % (1ULL << 24) : random_u64();
+            unsigned __int128 exact = (unsigned __int128) x * slower / faster;
+            uint64_t got = tense_scale_apply(x, mult, shift);
+
+            xs[i] = x % (1ULL << 32);
+
+            if (exact > UINT64_MAX) {
+                if (got != UINT64_MAX)
+                    ++mismatches;
+                continue;
+            }
+
+            if (x < limit) {
+                if (got != (uint64_t) exact)
+                    ++mismatches;
+            } else if (got - (uint64_t) exact > max_error) {
+                max_error = got - (uint64_t) exact;
+            }
+        }
+
+        if (mismatches)
+            failed = 1;
+
+        printf("%u\t%u\t%li\t%li\t%llu\t%.2lf\t%.2lf\n", faster, slower, samples,
+               mismatches, (unsigned long long) max_error,
+               bench_ns(xs, samples, iterations, faster, slower, mult, shift, 1),
+               bench_ns(xs, samples, iterations, faster, slower, mult, shift, 0));
+    }
+
+    free(xs);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
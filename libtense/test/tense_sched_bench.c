@@ -0,0 +1,165 @@
+/*
+ * Usage:
+ *
+ *   ./tense_sched_bench <pairs> <round trips> [tense]
+ *
+ * Scheduler-heavy workload in the style of perf bench sched pipe: <pairs> of
+ * threads pass a byte back and forth over pipes <round trips> times, so that
+ * nearly all of the time goes to wakeups and context switches. With tense
+ * given, every thread joins one experiment first. Pin it to one CPU with
+ * taskset -c to make every round trip two context switches.
+ *
+ * Compare the time per switch of three runs: on a stock kernel, on the patched
+ * kernel without the module or an experiment, and with tense on the patched
+ * kernel with the module loaded. The first two should be the same within
+ * noise since the hooks are patched out until there is an experiment.
+ *
+ * Output:
+ *
+ *   Tab-separated mode, context switches, real ns, ns per switch
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../tense.h"
+
+#define NSEC_IN_SEC 1000000000LL
+
+struct pair {
+    int ping[2];
+    int pong[2];
+};
+
+static long round_trips;
+static int use_tense;
+static pthread_barrier_t barrier;
+
+static long long now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return now.tv_sec * NSEC_IN_SEC + now.tv_nsec;
+}
+
+static void close_fd(int * fd) {
+    if (*fd != -1) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+static int join(void) {
+    if (use_tense && tense_init() == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void * ping(void * data) {
+    struct pair * pair = data;
+    char c = 0;
+
+    int err = join();
+    pthread_barrier_wait(&barrier);
+
+    for (long i = 0; !err && i < round_trips; ++i) {
+        if (write(pair->ping[1], &c, 1) != 1 || read(pair->pong[0], &c, 1) != 1)
+            err = -1;
+    }
+
+    // Let the other side see the end rather than wait forever
+    if (err)
+        close_fd(&pair->ping[1]);
+
+    if (use_tense)
+        tense_destroy();
+    return err ? (void *) -1 : NULL;
+}
+
+static void * pong(void * data) {
+    struct pair * pair = data;
+    char c;
+
+    int err = join();
+    pthread_barrier_wait(&barrier);
+
+    for (long i = 0; !err && i < round_trips; ++i) {
+        if (read(pair->ping[0], &c, 1) != 1 || write(pair->pong[1], &c, 1) != 1)
+            err = -1;
+    }
+
+    if (err)
+        close_fd(&pair->pong[1]);
+
+    if (use_tense)
+        tense_destroy();
+    return err ? (void *) -1 : NULL;
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 3 && argc != 4)
+        return EXIT_FAILURE;
+
+    int pairs = atoi(argv[1]);
+    round_trips = atol(argv[2]);
+    use_tense = argc == 4 && !strcmp(argv[3], "tense");
+
+    if (pairs <= 0 || round_trips <= 0)
+        return EXIT_FAILURE;
+
+    struct pair * p = calloc(pairs, sizeof(*p));
+    pthread_t * handles = calloc(2 * pairs, sizeof(*handles));
+    if (!p || !handles)
+        return EXIT_FAILURE;
+
+    // Everyone starts together once joined, the main thread included
+    pthread_barrier_init(&barrier, NULL, 2 * pairs + 1);
+
+    for (int i = 0; i < pairs; ++i) {
+        if (pipe(p[i].ping) || pipe(p[i].pong))
+            return EXIT_FAILURE;
+
+        if (pthread_create(&handles[2 * i], NULL, ping, &p[i])
+            || pthread_create(&handles[2 * i + 1], NULL, pong, &p[i]))
+            return EXIT_FAILURE;
+    }
+
+    pthread_barrier_wait(&barrier);
+    long long start = now_ns();
+
+    int failed = 0;
+    for (int i = 0; i < 2 * pairs; ++i) {
+        void * ret;
+
+        pthread_join(handles[i], &ret);
+        failed |= ret != NULL;
+    }
+
+    long long elapsed = now_ns() - start;
+    long long switches = 2LL * pairs * round_trips;
+
+    if (failed) {
+        fprintf(stderr, "failed to pass messages\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%s\t%lld\t%lld\t%.1f\n", use_tense ? "tense" : "plain", switches,
+           elapsed, (double) elapsed / switches);
+
+    for (int i = 0; i < pairs; ++i) {
+        close_fd(&p[i].ping[0]);
+        close_fd(&p[i].ping[1]);
+        close_fd(&p[i].pong[0]);
+        close_fd(&p[i].pong[1]);
+    }
+
+    pthread_barrier_destroy(&barrier);
+    free(handles);
+    free(p);
+    return EXIT_SUCCESS;
+}
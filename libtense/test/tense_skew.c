@@ -0,0 +1,135 @@
+/*
+ * Usage:
+ *
+ *   ./tense_skew <threads> <seconds>
+ *
+ * Starts <threads> tense threads which alternate bursts of busy work with
+ * short sleeps, so that CFS keeps moving them between CPUs, and samples the
+ * spread of their virtual times, the furthest minus the slowest, every
+ * millisecond for <seconds>. Run it with more threads than CPUs once with the
+ * module loaded with balance=0 and once with balance=1; the spread should be
+ * smaller with balance on, and the migrate line of tense_stats shows how much
+ * virtual time the moves skipped and how many were refused.
+ *
+ * Output:
+ *
+ *   Tab-separated samples, mean spread ns, max spread ns
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../tense.h"
+
+#define NSEC_IN_SEC 1000000000LL
+#define BURST_NS 2000000LL
+#define NAP_US 500
+
+static _Atomic long long * vtimes;
+static atomic_int stop;
+static pthread_barrier_t barrier;
+
+static long long now_ns(void) {
+    struct timespec now;
+
+    tense_time(&now);
+    return now.tv_sec * NSEC_IN_SEC + now.tv_nsec;
+}
+
+static void * thread_routine(void * data) {
+    long id = (long) data;
+
+    int err = tense_init();
+    pthread_barrier_wait(&barrier);
+
+    if (err == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return (void *) -1;
+    }
+
+    // Bursts of different lengths keep the load uneven across CPUs
+    long long burst = BURST_NS * (1 + id % 3);
+
+    while (!atomic_load(&stop)) {
+        long long start = now_ns();
+
+        while (now_ns() - start < burst)
+            atomic_store(&vtimes[id], now_ns());
+
+        usleep(NAP_US);
+        atomic_store(&vtimes[id], now_ns());
+    }
+
+    tense_destroy();
+    return NULL;
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 3)
+        return EXIT_FAILURE;
+
+    int threads = atoi(argv[1]);
+    long long samples = atol(argv[2]) * 1000;
+
+    if (threads <= 1 || samples <= 0)
+        return EXIT_FAILURE;
+
+    pthread_t * handles = calloc(threads, sizeof(*handles));
+    vtimes = calloc(threads, sizeof(*vtimes));
+    if (!handles || !vtimes)
+        return EXIT_FAILURE;
+
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+
+    for (long i = 0; i < threads; ++i) {
+        if (pthread_create(&handles[i], NULL, thread_routine, (void *) i))
+            return EXIT_FAILURE;
+    }
+
+    pthread_barrier_wait(&barrier);
+
+    long long total = 0, max_spread = 0, taken = 0;
+    for (long long s = 0; s < samples; ++s) {
+        usleep(1000);
+
+        long long lo = atomic_load(&vtimes[0]), hi = lo;
+        for (int i = 1; i < threads; ++i) {
+            long long t = atomic_load(&vtimes[i]);
+
+            lo = t < lo ? t : lo;
+            hi = t > hi ? t : hi;
+        }
+
+        // Until every thread has run once there is nothing to compare
+        if (!lo)
+            continue;
+
+        total += hi - lo;
+        max_spread = hi - lo > max_spread ? hi - lo : max_spread;
+        ++taken;
+    }
+
+    atomic_store(&stop, 1);
+
+    int failed = 0;
+    for (int i = 0; i < threads; ++i) {
+        void * ret;
+
+        pthread_join(handles[i], &ret);
+        failed |= ret != NULL;
+    }
+
+    if (failed)
+        return EXIT_FAILURE;
+
+    printf("%lld\t%.0f\t%lld\n", taken, taken ? (double) total / taken : 0.0,
+           max_spread);
+
+    pthread_barrier_destroy(&barrier);
+    free((void *) vtimes);
+    free(handles);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+/*
+ * Usage:
+ *
+ *   ./tense_slice <speedup> <competitors> <walks>
+ *
+ * Pins everything to CPU 0: <competitors> threads that spin forever and one
+ * tense thread walking a 4 MiB buffer <walks> times, so that every context
+ * switch costs it a refill of the cache. The walk runs twice: sped up with a
+ * TDF of <speedup>, then really doing 1 / <speedup> of the walks. With the
+ * timeslice dilation mode (dilation=1) of the module both runs should see
+ * about as many involuntary context switches per virtual second, with the
+ * default mode the sped up run sees <speedup> times as many.
+ *
+ * Output:
+ *
+ *   Tab-separated dilation mode, run, walks, involuntary context switches,
+ *   real ns, virtual ns, walks per virtual second
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "../tense.h"
+
+#define ONE_BILLION 1000000000L
+#define BUFFER_SIZE (4 << 20)
+#define CACHE_LINE 64
+#define timespec_delta(s, e) (((e).tv_sec - (s).tv_sec) * ONE_BILLION + ((e).tv_nsec - (s).tv_nsec))
+
+struct run {
+    const char * name;
+    unsigned int faster;
+    long walks;
+};
+
+static volatile char buffer[BUFFER_SIZE];
+
+static void pin(void) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void * competitor(void * data) {
+    (void) data;
+
+    pin();
+    for (;;)
+        ;
+    return NULL;
+}
+
+static int dilation_mode(void) {
+    FILE * f = fopen("/sys/module/tense/parameters/dilation", "r");
+    int mode = -1;
+
+    if (f) {
+        if (fscanf(f, "%d", &mode) != 1)
+            mode = -1;
+        fclose(f);
+    }
+    return mode;
+}
+
+static void * walker(void * data) {
+    struct run * run = data;
+    struct timespec real_start, real_end, virt_start, virt_end;
+    struct rusage before, after;
+
+    pin();
+
+    if (tense_init() == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return NULL;
+    }
+    tense_set_tdf(run->faster, 1);
+
+    getrusage(RUSAGE_THREAD, &before);
+    clock_gettime(CLOCK_MONOTONIC, &real_start);
+    tense_time(&virt_start);
+
+    for (long w = 0; w < run->walks; ++w)
+        for (int i = 0; i < BUFFER_SIZE; i += CACHE_LINE)
+            buffer[i]++;
+
+    tense_time(&virt_end);
+    clock_gettime(CLOCK_MONOTONIC, &real_end);
+    getrusage(RUSAGE_THREAD, &after);
+
+    long long real_ns = timespec_delta(real_start, real_end);
+    long long virt_ns = timespec_delta(virt_start, virt_end);
+
+    printf("%d\t%s\t%ld\t%ld\t%lld\t%lld\t%.1f\n", dilation_mode(), run->name,
+           run->walks, after.ru_nivcsw - before.ru_nivcsw, real_ns, virt_ns,
+           virt_ns ? run->walks * 1e9 / virt_ns : 0.0);
+
+    tense_destroy();
+    return NULL;
+}
+
+int main(int argc, char ** argv) {
+    pthread_t thread;
+
+    if (argc != 4)
+        return EXIT_FAILURE;
+
+    unsigned int speedup = (unsigned int) atoi(argv[1]);
+    int competitors = atoi(argv[2]);
+    long walks = atol(argv[3]);
+
+    if (speedup == 0)
+        return EXIT_FAILURE;
+
+    for (int i = 0; i < competitors; ++i) {
+        if (pthread_create(&thread, NULL, competitor, NULL))
+            return EXIT_FAILURE;
+        pthread_detach(thread);
+    }
+
+    struct run runs[] = {
+        { "dilated", speedup, walks },
+        { "real", 1, walks / speedup },
+    };
+
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i) {
+        if (pthread_create(&thread, NULL, walker, &runs[i]))
+            return EXIT_FAILURE;
+        pthread_join(thread, NULL);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+/*
+ * Usage:
+ *
+ *   ./tense_stress <threads> <seconds>
+ *
+ * Starts the given number of tense threads (10000 by default) which repeatedly
+ * sleep in virtual time for a random duration between 1 and 10 ms. Reports the
+ * average and maximum cost of the scheduler tick hook as measured by the
+ * module. Run with an increasing number of threads to check that the cost
+ * stays flat, i.e. a tick only touches sleepers that are actually due.
+ *
+ * Output:
+ *
+ *   Tab-separated threads, started, ticks, avg ns per tick, max ns, wakeups
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../tense.h"
+
+#define STATS_FILE "/sys/kernel/debug/tense_stats"
+#define STACK_SIZE (64 * 1024)
+#define ONE_MILLION 1000000ULL
+
+static volatile int exiting = 0;
+
+struct stats {
+    unsigned long long ticks;
+    unsigned long long tick_ns;
+    unsigned long long tick_max_ns;
+    unsigned long long wakeups;
+};
+
+static int
+stats_reset(void)
+{
+    FILE * f = fopen(STATS_FILE, "w");
+    if (!f)
+        return -1;
+
+    fputs("0\n", f);
+    fclose(f);
+    return 0;
+}
+
+static int
+stats_read(struct stats * st)
+{
+    char key[32];
+    unsigned long long value;
+    FILE * f = fopen(STATS_FILE, "r");
+    if (!f)
+        return -1;
+
+    memset(st, 0, sizeof(*st));
+    while (fscanf(f, "%31s %llu", key, &value) == 2) {
+        if (!strcmp(key, "ticks"))
+            st->ticks = value;
+        else if (!strcmp(key, "tick_ns"))
+            st->tick_ns = value;
+        else if (!strcmp(key, "tick_max_ns"))
+            st->tick_max_ns = value;
+        else if (!strcmp(key, "wakeups"))
+            st->wakeups = value;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static void *
+sleeper(void * data)
+{
+    unsigned int seed = (unsigned int) (unsigned long) data;
+
+    if (tense_init() == -1)
+        return NULL;
+
+    while (!exiting) {
+        // Spin a little so that tense tasks are running when the tick comes
+        for (volatile int i = 0; i < 10000; ++i);
+        tense_sleep_ns((1 + rand_r(&seed) % 10) * ONE_MILLION);
+    }
+
+    tense_destroy();
+    return NULL;
+}
+
+int
+main(int argc, char ** argv)
+{
+    int n_threads = argc > 1 ? atoi(argv[1]) : 10000;
+    int seconds = argc > 2 ? atoi(argv[2]) : 10;
+    int started = 0;
+    pthread_t * threads;
+    pthread_attr_t attr;
+    struct stats st;
+
+    threads = calloc((size_t) n_threads, sizeof(*threads));
+    if (!threads)
+        return EXIT_FAILURE;
+
+    if (stats_reset() == -1) {
+        fprintf(stderr, "failed to reset %s\n", STATS_FILE);
+        return EXIT_FAILURE;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, STACK_SIZE);
+
+    for (; started < n_threads; ++started) {
+        if (pthread_create(&threads[started], &attr, sleeper, (void *) (unsigned long) started)) {
+            fprintf(stderr, "failed to create thread %d\n", started);
+            break;
+        }
+    }
+
+    sleep((unsigned int) seconds);
+
+    if (stats_read(&st) == -1) {
+        fprintf(stderr, "failed to read %s\n", STATS_FILE);
+        return EXIT_FAILURE;
+    }
+
+    exiting = 1;
+    for (int i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    printf("%d\t%d\t%llu\t%.1lf\t%llu\t%llu\n", n_threads, started, st.ticks,
+           st.ticks ? st.tick_ns / (double) st.ticks : 0.0,
+           st.tick_max_ns, st.wakeups);
+
+    pthread_attr_destroy(&attr);
+    free(threads);
+    return EXIT_SUCCESS;
+}
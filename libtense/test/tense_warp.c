@@ -0,0 +1,105 @@
+/*
+ * Usage:
+ *
+ *   ./tense_warp <iterations> <work>
+ *
+ * First times <iterations> nested tense_warp_push(200), tense_warp_push(400),
+ * tense_warp_pop() pairs against the same nesting done with
+ * tense_scale_percent, which enters the kernel. Then runs <work> busy loop
+ * iterations plain, inside push(200) and inside push(200) plus push(400), where
+ * virtual time should pass 1, 2 and 8 times slower than real time. The factor
+ * is only picked up at the next tick, so <work> should take a good number of
+ * ticks.
+ *
+ * Output:
+ *
+ *   Tab-separated run, real ns, virtual ns, real / virtual
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../tense.h"
+
+#define ONE_BILLION 1000000000L
+#define timespec_delta(s, e) (((e).tv_sec - (s).tv_sec) * ONE_BILLION + ((e).tv_nsec - (s).tv_nsec))
+
+static void work(long n) {
+    for (volatile long i = 0; i < n; ++i)
+        ;
+}
+
+static void report(const char * name, long long real_ns, long long virt_ns) {
+    printf("%s\t%lld\t%lld\t%.2f\n", name, real_ns, virt_ns,
+           virt_ns ? (double) real_ns / virt_ns : 0.0);
+}
+
+static void run(const char * name, int depth, long n) {
+    struct timespec real_start, real_end, virt_start, virt_end;
+    static const int percents[] = { 200, 400 };
+
+    for (int i = 0; i < depth; ++i)
+        tense_warp_push(percents[i]);
+
+    clock_gettime(CLOCK_MONOTONIC, &real_start);
+    tense_time(&virt_start);
+    work(n);
+    tense_time(&virt_end);
+    clock_gettime(CLOCK_MONOTONIC, &real_end);
+
+    for (int i = 0; i < depth; ++i)
+        tense_warp_pop();
+
+    report(name, timespec_delta(real_start, real_end),
+           timespec_delta(virt_start, virt_end));
+}
+
+int main(int argc, char ** argv) {
+    struct timespec start, end;
+
+    if (argc != 3)
+        return EXIT_FAILURE;
+
+    long iterations = atol(argv[1]);
+    long n = atol(argv[2]);
+
+    if (tense_init() == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return EXIT_FAILURE;
+    }
+
+    if (tense_warp_push(100) == -1) {
+        perror("no warp stack");
+        return EXIT_FAILURE;
+    }
+    tense_warp_pop();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; ++i) {
+        tense_warp_push(200);
+        tense_warp_push(400);
+        tense_warp_pop();
+        tense_warp_pop();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("warp\t%.1f ns per push and pop\n",
+           (double) timespec_delta(start, end) / (2 * iterations));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; ++i) {
+        tense_scale_percent(200);
+        tense_scale_percent(400);
+        tense_scale_percent(25);
+        tense_scale_percent(50);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("syscall\t%.1f ns per push and pop\n",
+           (double) timespec_delta(start, end) / (2 * iterations));
+
+    run("plain", 0, n);
+    run("warp 2", 1, n);
+    run("warp 8", 2, n);
+
+    tense_destroy();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,67 @@
+/*
+ * Usage:
+ *
+ *   ./time_read <iterations>
+ *
+ * Compares the cost per call of reading virtual time through the shared page
+ * (tense_time) and through read() on the tense file (tense_time_syscall).
+ *
+ * Output:
+ *
+ *   Tab-separated method, iterations, ns per call
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../tense.h"
+
+#define ONE_BILLION 1000000000L
+#define timespec_delta(s, e) (((e).tv_sec - (s).tv_sec) * ONE_BILLION + ((e).tv_nsec - (s).tv_nsec))
+
+static int
+bench(const char * name, int (*read_time) (struct timespec *), long iterations)
+{
+    struct timespec start, end, tp;
+
+    if (clock_gettime(CLOCK_MONOTONIC_RAW, &start) == -1) {
+        fprintf(stderr, "failed to get time\n");
+        return -1;
+    }
+
+    for (long i = 0; i < iterations; ++i) {
+        if (read_time(&tp) == -1) {
+            fprintf(stderr, "%s failed\n", name);
+            return -1;
+        }
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC_RAW, &end) == -1) {
+        fprintf(stderr, "failed to get time\n");
+        return -1;
+    }
+
+    printf("%s\t%li\t%.1lf\n", name, iterations,
+           timespec_delta(start, end) / (double) iterations);
+    return 0;
+}
+
+int
+main(int argc, char ** argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+
+    if (tense_init() == -1) {
+        fprintf(stderr, "failed to initialize tense\n");
+        return EXIT_FAILURE;
+    }
+
+    if (bench("page", tense_time, iterations) == -1
+        || bench("read", tense_time_syscall, iterations) == -1) {
+        tense_destroy();
+        return EXIT_FAILURE;
+    }
+
+    tense_destroy();
+    return EXIT_SUCCESS;
+}
@@ -37,8 +37,8 @@ pthread_mutex_t mutex;
 #define lock() pthread_mutex_lock(&mutex);
 #define unlock() pthread_mutex_unlock(&mutex);
 
-// busy loop
-#define run(x) for (volatile int j = 0; j < x * 550000; ++j) { asm(""); }
+// busy loop for x ms of real time
+#define run(x) tense_spin_ns((x) * 1000000ULL);
 // tense actions
 #define MS << 20 
 #define jump(x) tense_move_ns(x MS);